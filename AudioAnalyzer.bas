@@ -147,6 +147,7 @@ FUNCTION AudioAnalyzer_Init%% (handle AS LONG)
         __AudioAnalyzer.style = AUDIOANALYZER_STYLE_OSCILLOSCOPE1
 
         AudioAnalyzer_SetFFTScale __AUDIOANALYZER_FFT_SCALE_X, __AUDIOANALYZER_FFT_SCALE_Y
+        AudioAnalyzer_SetSpectrumBandProperties __AUDIOANALYZER_SPECTRUM_BANDS, AUDIOANALYZERFFT_BANDS_LOG
         AudioAnalyzer_SetVUPeakFallSpeed __AUDIOANALYZER_VU_PEAK_FALL_SPEED
         AudioAnalyzer_SetProgressProperties _FALSE, __AUDIOANALYZER_TEXT_COLOR
         AudioAnalyzer_SetColors _RGB32(0, 255, 0), _RGB32(255, 0, 0), _RGB32(0, 0, 255)
@@ -166,6 +167,7 @@ FUNCTION AudioAnalyzer_Init%% (handle AS LONG)
 
             REDIM __AudioAnalyzer_IntensityBuffer(0 TO __AudioAnalyzer.channels - 1) AS SINGLE
             REDIM __AudioAnalyzer_PeakBuffer(0 TO __AudioAnalyzer.channels - 1) AS SINGLE
+            REDIM __AudioAnalyzer_Waterfalls(0 TO __AudioAnalyzer.channels - 1) AS __AudioAnalyzer_WaterfallType
 
             AudioAnalyzer_SetStarCount __AUDIOANALYZER_STAR_COUNT
             AudioAnalyzer_SetCircleWaveCount __AUDIOANALYZER_CIRCLE_WAVE_COUNT
@@ -184,12 +186,18 @@ END FUNCTION
 
 SUB AudioAnalyzer_Done
     SHARED __AudioAnalyzer AS __AudioAnalyzerType
+    SHARED __AudioAnalyzer_Waterfalls() AS __AudioAnalyzer_WaterfallType
 
     IF __AudioAnalyzer.handle THEN
         IF __AudioAnalyzer.viewport THEN
             _FREEIMAGE __AudioAnalyzer.viewport
             __AudioAnalyzer.viewport = 0
         END IF
+
+        DIM i AS LONG
+        FOR i = LBOUND(__AudioAnalyzer_Waterfalls) TO UBOUND(__AudioAnalyzer_Waterfalls)
+            __AudioAnalyzer_FreeWaterfall i
+        NEXT i
         __AudioAnalyzer.handle = 0
         '_MEMFREE __AudioAnalyzer.buffer - this is not needed as _SNDCLOSE auto-frees the mem block
         __AudioAnalyzer.format = __AUDIOANALYZER_FORMAT_UNKNOWN
@@ -301,9 +309,16 @@ END SUB
 
 SUB AudioAnalyzer_SetColors (color1 AS _UNSIGNED LONG, color2 AS _UNSIGNED LONG, color3 AS _UNSIGNED LONG)
     SHARED __AudioAnalyzer AS __AudioAnalyzerType
+    SHARED __AudioAnalyzer_Waterfalls() AS __AudioAnalyzer_WaterfallType
+
     __AudioAnalyzer.color1 = color1
     __AudioAnalyzer.color2 = color2
     __AudioAnalyzer.color3 = color3
+
+    DIM i AS LONG
+    FOR i = LBOUND(__AudioAnalyzer_Waterfalls) TO UBOUND(__AudioAnalyzer_Waterfalls)
+        IF __AudioAnalyzer_Waterfalls(i).renderer THEN AudioAnalyzerWaterfall_SetGradient __AudioAnalyzer_Waterfalls(i).renderer, BGRA_BLACK, __AudioAnalyzer.color1, __AudioAnalyzer.color2
+    NEXT i
 END SUB
 
 
@@ -314,6 +329,19 @@ SUB AudioAnalyzer_SetFFTScale (x AS _UNSIGNED _BYTE, y AS _UNSIGNED _BYTE)
 END SUB
 
 
+' Sets the number of bands and the band scale (AUDIOANALYZERFFT_BANDS_*) used by AUDIOANALYZER_STYLE_SPECTRUM_BANDS
+SUB AudioAnalyzer_SetSpectrumBandProperties (bands AS _UNSIGNED LONG, scale AS LONG)
+    SHARED __AudioAnalyzer AS __AudioAnalyzerType
+    SHARED __AudioAnalyzer_BandBuffer() AS SINGLE
+
+    IF bands > 0 THEN
+        __AudioAnalyzer.spectrumBands = bands
+        __AudioAnalyzer.spectrumBandScale = scale
+        REDIM __AudioAnalyzer_BandBuffer(0 TO __AudioAnalyzer.spectrumBands - 1) AS SINGLE
+    END IF
+END SUB
+
+
 SUB AudioAnalyzer_SetVUPeakFallSpeed (speed AS SINGLE)
     SHARED __AudioAnalyzer AS __AudioAnalyzerType
     IF speed > 0! THEN __AudioAnalyzer.vuPeakFallSpeed = speed
@@ -430,6 +458,108 @@ SUB AudioAnalyzer_RenderSpectrum (w AS LONG, h AS LONG, channel AS _UNSIGNED _BY
 END SUB
 
 
+SUB AudioAnalyzer_RenderSpectrumBands (w AS LONG, h AS LONG, channel AS _UNSIGNED _BYTE)
+    SHARED __AudioAnalyzer AS __AudioAnalyzerType
+    SHARED __AudioAnalyzer_FFTBuffer() AS _UNSIGNED INTEGER
+    SHARED __AudioAnalyzer_BandBuffer() AS SINGLE
+
+    ' The bin-to-band map is cached on the C side, so this is a single pass over the FFT buffer
+    DIM bands AS _UNSIGNED LONG: bands = AudioAnalyzerFFT_AggregateBandsInteger(__AudioAnalyzer_BandBuffer(0), __AudioAnalyzer_FFTBuffer(0, channel), _SNDRATE, __AudioAnalyzer.fftBits, __AudioAnalyzer.spectrumBandScale, __AudioAnalyzer.spectrumBands)
+    IF bands = 0 THEN EXIT SUB
+
+    DIM yScale AS SINGLE: yScale = 1! / _SHL(1, __AudioAnalyzer.fftScale.y)
+    DIM AS LONG i, s, e, v
+
+    IF h > w THEN
+        DIM r AS LONG: r = w - 1
+
+        WHILE i < bands
+            s = (i * h) \ bands
+            e = ((i + 1) * h) \ bands - 2
+            IF e < s THEN e = s
+
+            v = __AudioAnalyzer_BandBuffer(i) * yScale
+            IF v > r THEN v = r
+
+            IF channel AND 1 THEN
+                Graphics_DrawFilledRectangle 0, s, v, e, Graphics_InterpolateColor(__AudioAnalyzer.color1, __AudioAnalyzer.color2, v / r)
+            ELSE
+                Graphics_DrawFilledRectangle r - v, s, r, e, Graphics_InterpolateColor(__AudioAnalyzer.color1, __AudioAnalyzer.color2, v / r)
+            END IF
+
+            i = i + 1
+        WEND
+    ELSE
+        DIM b AS LONG: b = h - 1
+
+        WHILE i < bands
+            s = (i * w) \ bands
+            e = ((i + 1) * w) \ bands - 2
+            IF e < s THEN e = s
+
+            v = __AudioAnalyzer_BandBuffer(i) * yScale
+            IF v > b THEN v = b
+
+            Graphics_DrawFilledRectangle s, b - v, e, b, Graphics_InterpolateColor(__AudioAnalyzer.color1, __AudioAnalyzer.color2, v / b)
+
+            i = i + 1
+        WEND
+    END IF
+END SUB
+
+
+SUB __AudioAnalyzer_FreeWaterfall (channel AS LONG)
+    SHARED __AudioAnalyzer_Waterfalls() AS __AudioAnalyzer_WaterfallType
+
+    IF __AudioAnalyzer_Waterfalls(channel).renderer THEN
+        AudioAnalyzerWaterfall_Destroy __AudioAnalyzer_Waterfalls(channel).renderer
+        __AudioAnalyzer_Waterfalls(channel).renderer = NULL
+    END IF
+
+    IF __AudioAnalyzer_Waterfalls(channel).image < -1 THEN
+        _FREEIMAGE __AudioAnalyzer_Waterfalls(channel).image
+        __AudioAnalyzer_Waterfalls(channel).image = 0
+    END IF
+END SUB
+
+
+SUB AudioAnalyzer_RenderSpectrogram (w AS LONG, h AS LONG, channel AS _UNSIGNED _BYTE)
+    SHARED __AudioAnalyzer AS __AudioAnalyzerType
+    SHARED __AudioAnalyzer_FFTBuffer() AS _UNSIGNED INTEGER
+    SHARED __AudioAnalyzer_WaterfallBuffer() AS SINGLE
+    SHARED __AudioAnalyzer_Waterfalls() AS __AudioAnalyzer_WaterfallType
+
+    ' The waterfall keeps its history in a persistent image that is recreated only when the size changes
+    IF __AudioAnalyzer_Waterfalls(channel).image >= -1 _ORELSE w <> _WIDTH(__AudioAnalyzer_Waterfalls(channel).image) _ORELSE h <> _HEIGHT(__AudioAnalyzer_Waterfalls(channel).image) THEN
+        __AudioAnalyzer_FreeWaterfall channel
+
+        __AudioAnalyzer_Waterfalls(channel).image = _NEWIMAGE(w, h, 32)
+        IF __AudioAnalyzer_Waterfalls(channel).image >= -1 THEN EXIT SUB
+
+        ' Time runs along the longer side
+        IF h > w THEN
+            __AudioAnalyzer_Waterfalls(channel).renderer = AudioAnalyzerWaterfall_Create(__AudioAnalyzer_Waterfalls(channel).image, AUDIOANALYZERWATERFALL_ORIENTATION_VERTICAL, _FALSE)
+        ELSE
+            __AudioAnalyzer_Waterfalls(channel).renderer = AudioAnalyzerWaterfall_Create(__AudioAnalyzer_Waterfalls(channel).image, AUDIOANALYZERWATERFALL_ORIENTATION_HORIZONTAL, _FALSE)
+        END IF
+
+        AudioAnalyzerWaterfall_SetRange __AudioAnalyzer_Waterfalls(channel).renderer, __AUDIOANALYZER_SPECTROGRAM_FLOOR_DB, __AUDIOANALYZER_SPECTROGRAM_CEILING_DB
+        AudioAnalyzerWaterfall_SetGradient __AudioAnalyzer_Waterfalls(channel).renderer, BGRA_BLACK, __AudioAnalyzer.color1, __AudioAnalyzer.color2
+        AudioAnalyzerWaterfall_Reset __AudioAnalyzer_Waterfalls(channel).renderer
+    END IF
+
+    ' One band per pixel along the frequency axis
+    DIM bands AS _UNSIGNED LONG
+    IF h > w THEN bands = w ELSE bands = h
+    IF UBOUND(__AudioAnalyzer_WaterfallBuffer) <> bands - 1 THEN REDIM __AudioAnalyzer_WaterfallBuffer(0 TO bands - 1) AS SINGLE
+
+    bands = AudioAnalyzerFFT_AggregateBandsInteger(__AudioAnalyzer_WaterfallBuffer(0), __AudioAnalyzer_FFTBuffer(0, channel), _SNDRATE, __AudioAnalyzer.fftBits, __AudioAnalyzer.spectrumBandScale, bands)
+    AudioAnalyzerWaterfall_Push __AudioAnalyzer_Waterfalls(channel).renderer, __AudioAnalyzer_WaterfallBuffer(0), bands
+
+    _PUTIMAGE (0, 0), __AudioAnalyzer_Waterfalls(channel).image
+END SUB
+
+
 SUB AudioAnalyzer_RenderOscilloscope1 (w AS LONG, h AS LONG, channel AS _UNSIGNED _BYTE)
     SHARED __AudioAnalyzer AS __AudioAnalyzerType
     SHARED __AudioAnalyzer_ClipBuffer() AS SINGLE
@@ -806,23 +936,14 @@ SUB AudioAnalyzer_Update
         DIM byteOffset AS _UNSIGNED _OFFSET: byteOffset = __AudioAnalyzer.buffer.OFFSET + __AudioAnalyzer.currentFrame * __AudioAnalyzer.buffer.ELEMENTSIZE
 
         IF byteOffset <= __AudioAnalyzer.buffer.OFFSET + __AudioAnalyzer.buffer.SIZE - __AudioAnalyzer.clipBufferSamples * __AudioAnalyzer.buffer.ELEMENTSIZE THEN
-            SELECT CASE __AudioAnalyzer.format
-                CASE __AUDIOANALYZER_FORMAT_U8
-                    AudioConv_ConvertU8ToF32 byteOffset, __AudioAnalyzer.clipBufferSamples, _OFFSET(__AudioAnalyzer_ClipBuffer(0))
-
-                CASE __AUDIOANALYZER_FORMAT_S16
-                    AudioConv_ConvertS16ToF32 byteOffset, __AudioAnalyzer.clipBufferSamples, _OFFSET(__AudioAnalyzer_ClipBuffer(0))
+            ' The analyzer formats map directly to AudioConv formats, so this is a single table dispatch on the C++ side
+            AudioConv_Convert __AudioAnalyzer.format, AUDIOCONV_FORMAT_F32, byteOffset, _OFFSET(__AudioAnalyzer_ClipBuffer(0)), __AudioAnalyzer.clipBufferSamples
 
-                CASE __AUDIOANALYZER_FORMAT_S32
-                    AudioConv_ConvertS32ToF32 byteOffset, __AudioAnalyzer.clipBufferSamples, _OFFSET(__AudioAnalyzer_ClipBuffer(0))
-
-                CASE __AUDIOANALYZER_FORMAT_F32
-                    CopyMemory _OFFSET(__AudioAnalyzer_ClipBuffer(0)), byteOffset, __AudioAnalyzer.clipBufferSamples * _SIZE_OF_SINGLE
-            END SELECT
+            ' Transform all channels in one go; the channels are shared between the persistent FFT worker threads
+            AudioAnalyzerFFT_DoSingleInterleaved __AudioAnalyzer_FFTBuffer(0, 0), __AudioAnalyzer_IntensityBuffer(0), __AudioAnalyzer_ClipBuffer(0), __AudioAnalyzer.channels, __AudioAnalyzer.fftBits, _TRUE
 
             i = 0
             WHILE i < __AudioAnalyzer.channels
-                __AudioAnalyzer_IntensityBuffer(i) = AudioAnalyzerFFT_DoSingle(__AudioAnalyzer_FFTBuffer(0, i), __AudioAnalyzer_ClipBuffer(i), __AudioAnalyzer.channels, __AudioAnalyzer.fftBits)
                 IF __AudioAnalyzer_IntensityBuffer(i) > __AudioAnalyzer_PeakBuffer(i) THEN __AudioAnalyzer_PeakBuffer(i) = __AudioAnalyzer_IntensityBuffer(i)
                 __AudioAnalyzer_PeakBuffer(i) = __AudioAnalyzer_PeakBuffer(i) - __AudioAnalyzer.vuPeakFallSpeed
                 IF __AudioAnalyzer_PeakBuffer(i) <= 0! THEN __AudioAnalyzer_PeakBuffer(i) = 0!
@@ -853,6 +974,12 @@ SUB AudioAnalyzer_RenderDirect (w AS LONG, h AS LONG, channel AS _UNSIGNED _BYTE
                 CASE AUDIOANALYZER_STYLE_SPECTRUM
                     AudioAnalyzer_RenderSpectrum w, h, channel
 
+                CASE AUDIOANALYZER_STYLE_SPECTRUM_BANDS
+                    AudioAnalyzer_RenderSpectrumBands w, h, channel
+
+                CASE AUDIOANALYZER_STYLE_SPECTROGRAM
+                    AudioAnalyzer_RenderSpectrogram w, h, channel
+
                 CASE AUDIOANALYZER_STYLE_CIRCULAR_WAVEFORM
                     AudioAnalyzer_RenderCircularWaveform w, h, channel
 
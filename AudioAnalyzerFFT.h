@@ -10,171 +10,724 @@
 
 #pragma once
 
+#include "Types.h"
+#include "WorkerPool.h"
 #include <cstdint>
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstdlib>
-
-/// @brief FFT singleton class for audio spectrum analysis.
+#include <list>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/// @brief FFT class for audio spectrum analysis.
+/// This uses a floating-point real-input FFT: N real samples are packed into an N / 2 point complex FFT which is then
+/// split into the N / 2 + 1 positive frequency bins. The complex FFT works on split real / imaginary arrays so that the
+/// butterfly loops are contiguous and can be vectorized by the compiler.
+/// Each object owns its working buffers, so different objects can be used concurrently from different threads. The
+/// twiddle and bit-reversal tables are read-only and shared between all objects of the same size.
 class AudioAnalyzerFFT
 {
 public:
-    float DoFFT(uint16_t *amplitudeArray, const int16_t *sampleData, int sampleIncrement, int bitDepth)
-    {
-        const auto numSamples = std::min(1 << bitDepth, NUM_SAMPLES);
-        const auto halfNumSamples = numSamples >> 1;
-        auto averageIntensity = 0.0f;
+    static constexpr auto FFT_POWER_MIN = 2;
+    static constexpr auto FFT_POWER_MAX = 16;
 
-        for (auto i = 0; i < numSamples; ++i)
+    /// @brief Read-only tables (the "plan") for one FFT size. These are built lazily the first time a size is used and are
+    /// then shared by all objects of that size, so memory only grows with the sizes that are actually used.
+    struct Tables
+    {
+        int bitDepth;
+        std::vector<uint32_t> bitReversal;    // bit-reversal permutation of the N / 2 point complex FFT
+        std::vector<float> twiddleReal;       // W(2h, j) for j < h, stored stage after stage (h = 2, 4, ... N / 4)
+        std::vector<float> twiddleImag;       //
+        std::vector<float> splitTwiddleReal;  // W(N, k) for k <= N / 2
+        std::vector<float> splitTwiddleImag;  //
+
+        explicit Tables(int bitDepth) : bitDepth(bitDepth)
         {
-            auto sample = float(*sampleData) * S16_TO_F32_MULTIPLIER;
-            fftBuffer[i][0] = int32_t(*sampleData) << 12;
-            fftBuffer[i][1] = 0;
-            averageIntensity += sample * sample;
-            sampleData += sampleIncrement;
-        }
+            const auto size = 1 << bitDepth;
+            const auto half = size >> 1;
+            const auto quarter = half >> 1;
+
+            // Twiddles for the complex FFT stages after the first one. Each stage gets its own contiguous run so that the
+            // butterfly loop reads them with unit stride: W(2h, j) = e^(-2 * pi * i * j / 2h) for j < h
+            // The run for stage h starts at offset h - 2 (2 + 4 + ... + h / 2 = h - 2)
+            twiddleReal.resize(std::max(half - 2, 0));
+            twiddleImag.resize(twiddleReal.size());
+            for (auto h = 2; h < half; h <<= 1)
+            {
+                for (auto j = 0; j < h; j++)
+                {
+                    auto angle = (M_PI * j) / double(h);
+                    twiddleReal[h - 2 + j] = float(std::cos(angle));
+                    twiddleImag[h - 2 + j] = float(-std::sin(angle));
+                }
+            }
+
+            // Twiddles for the real spectrum split: W(N, k) = e^(-2 * pi * i * k / N) for k <= N / 2
+            splitTwiddleReal.resize(half + 1);
+            splitTwiddleImag.resize(half + 1);
+            for (auto i = 0; i <= half; i++)
+            {
+                auto angle = (2.0 * M_PI * i) / double(size);
+                splitTwiddleReal[i] = float(std::cos(angle));
+                splitTwiddleImag[i] = float(-std::sin(angle));
+            }
 
-        averageIntensity = averageIntensity / float(numSamples);
+            bitReversal.resize(half);
 
-        PerformButterflyOperation(fftBuffer, bitDepth);
+            uint32_t reversedIndex = 0;
+            uint32_t step = 0;
 
-        for (auto i = 1; i <= halfNumSamples; ++i)
-        {
-            auto realPart = fftBuffer[bitReversalTable[i] >> (FFT_POWER - bitDepth)][0] >> 12;
-            auto imagPart = fftBuffer[bitReversalTable[i] >> (FFT_POWER - bitDepth)][1] >> 12;
-            amplitudeArray[i - 1] = uint16_t(std::sqrt((realPart * realPart + imagPart * imagPart) * i));
+            for (auto i = 0; i < half; ++i)
+            {
+                bitReversal[i] = reversedIndex;
+                for (step = quarter; step && (step <= reversedIndex); step >>= 1)
+                    reversedIndex -= step;
+                reversedIndex += step;
+            }
         }
+    };
+
+    /// @brief Creates an FFT object for a fixed size.
+    /// @param bitDepth The bit depth representing the number of samples. This is clamped to [FFT_POWER_MIN, FFT_POWER_MAX].
+    explicit AudioAnalyzerFFT(int bitDepth)
+    {
+        tables = GetTables(ClampBitDepth(bitDepth));
+        fftReal.resize(GetSize() >> 1);
+        fftImag.resize(GetSize() >> 1);
+    }
+
+    AudioAnalyzerFFT() = delete;
+    AudioAnalyzerFFT(const AudioAnalyzerFFT &) = delete;
+    AudioAnalyzerFFT &operator=(const AudioAnalyzerFFT &) = delete;
+
+    int GetBitDepth() const { return tables->bitDepth; }
+
+    /// @brief Returns the number of input samples (N).
+    uint32_t GetSize() const { return 1u << tables->bitDepth; }
+
+    /// @brief Returns the number of spectrum bins (N / 2 + 1).
+    uint32_t GetBins() const { return (GetSize() >> 1) + 1; }
+
+    /// @brief Computes the spectrum of real samples.
+    /// @param spectrumArray The array where the resulting (N / 2 + 1) bins are stored. Bins are scaled by 2 / N so that a full-scale sine wave has a magnitude of ~1.0, except DC (k = 0) and Nyquist (k = N / 2), which have no negative frequency twin and are scaled by 1 / N so that a constant offset reads as itself.
+    /// @param sampleData An array of floating-point (FP32) samples.
+    /// @param sampleIncrement The number to use to get to the next sample in sampleData. For stereo interleaved samples use 2, else 1.
+    /// @param asPower If true, the squared magnitudes (power) are returned instead of magnitudes.
+    /// @return Returns the average intensity level of the audio signal.
+    float DoFFT(float *spectrumArray, const float *sampleData, int sampleIncrement, bool asPower)
+    {
+        auto averageIntensity = LoadSamples(sampleData, sampleIncrement, 1.0f);
+        const auto scale = 2.0f / float(GetSize());
+        const auto nyquist = int(GetSize() >> 1);
+
+        Transform();
+
+        SplitRealSpectrum([&](int k, float realPart, float imagPart)
+                          {
+                              auto binScale = k == 0 or k == nyquist ? 0.5f * scale : scale;
+                              auto power = (realPart * realPart + imagPart * imagPart) * binScale * binScale;
+                              spectrumArray[k] = asPower ? power : std::sqrt(power); });
 
         return averageIntensity;
     }
 
-    float DoFFT(uint16_t *amplitudeArray, const float *sampleData, int sampleIncrement, int bitDepth)
+    float DoFFT(uint16_t *amplitudeArray, const int16_t *sampleData, int sampleIncrement)
     {
-        const auto numSamples = std::min(1 << bitDepth, NUM_SAMPLES);
-        const auto halfNumSamples = numSamples >> 1;
-        auto averageIntensity = 0.0f;
+        auto averageIntensity = LoadSamples(sampleData, sampleIncrement, S16_TO_F32_MULTIPLIER);
 
-        for (auto i = 0; i < numSamples; ++i)
-        {
-            auto sample = std::fmaxf(std::fminf(*sampleData, 1.0f), -1.0f);
-            fftBuffer[i][0] = int32_t(sample * F32_TO_S16_MULTIPLIER) << 12;
-            fftBuffer[i][1] = 0;
-            averageIntensity += sample * sample;
-            sampleData += sampleIncrement;
-        }
+        Transform();
+        StoreAmplitudes(amplitudeArray, 32768.0f);
 
-        averageIntensity = averageIntensity / float(numSamples);
+        return averageIntensity;
+    }
 
-        PerformButterflyOperation(fftBuffer, bitDepth);
+    float DoFFT(uint16_t *amplitudeArray, const float *sampleData, int sampleIncrement)
+    {
+        auto averageIntensity = LoadSamples(sampleData, sampleIncrement, 1.0f);
 
-        for (auto i = 1; i <= halfNumSamples; ++i)
-        {
-            auto realPart = fftBuffer[bitReversalTable[i] >> (FFT_POWER - bitDepth)][0] >> 12;
-            auto imagPart = fftBuffer[bitReversalTable[i] >> (FFT_POWER - bitDepth)][1] >> 12;
-            amplitudeArray[i - 1] = uint16_t(std::sqrt((realPart * realPart + imagPart * imagPart) * i));
-        }
+        Transform();
+        StoreAmplitudes(amplitudeArray, F32_TO_S16_MULTIPLIER);
 
         return averageIntensity;
     }
 
-    static AudioAnalyzerFFT &Instance()
+    /// @brief Returns the shared tables for a size. Tables are built lazily on first use and then cached.
+    /// @param bitDepth The bit depth representing the number of samples. This must be in [FFT_POWER_MIN, FFT_POWER_MAX].
+    static std::shared_ptr<const Tables> GetTables(int bitDepth)
     {
-        static AudioAnalyzerFFT instance;
+        static std::mutex cacheMutex;
+        static std::array<std::shared_ptr<const Tables>, FFT_POWER_MAX + 1> cache;
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
 
-        return instance;
+        auto &entry = cache[bitDepth];
+        if (!entry)
+            entry = std::make_shared<const Tables>(bitDepth);
+
+        return entry;
+    }
+
+    static inline constexpr int ClampBitDepth(int bitDepth)
+    {
+        return std::clamp(bitDepth, FFT_POWER_MIN, FFT_POWER_MAX);
     }
 
 private:
-    static constexpr auto FFT_POWER = 11;
-    static constexpr auto NUM_SAMPLES = 1 << FFT_POWER;
-    static constexpr auto HALF_SAMPLES = NUM_SAMPLES >> 1;
-    static constexpr auto QUARTER_SAMPLES = HALF_SAMPLES >> 1;
-    static constexpr auto SCALE_FACTOR = 1 << 28;
     static constexpr auto S16_TO_F32_MULTIPLIER = 1.0f / 32768.0f;
     static constexpr auto F32_TO_S16_MULTIPLIER = 32767.0f;
 
-    AudioAnalyzerFFT()
+    /// @brief Packs the real samples as complex pairs (even = real, odd = imaginary) in bit-reversed order.
+    template <typename T>
+    float LoadSamples(const T *sampleData, int sampleIncrement, float multiplier)
     {
-        for (auto i = 0; i < QUARTER_SAMPLES; i++)
+        const auto numPairs = int(GetSize() >> 1);
+        const auto pairIncrement = sampleIncrement << 1;
+        const auto bitReversal = tables->bitReversal.data();
+        auto averageIntensity = 0.0f;
+
+        for (auto i = 0; i < numPairs; ++i)
         {
-            auto angle = (2.0 * M_PI * i) / (4.0 * QUARTER_SAMPLES);
-            sinCosTable[i][0] = int32_t(std::cos(angle) * SCALE_FACTOR);
-            sinCosTable[i][1] = int32_t(std::sin(angle) * SCALE_FACTOR);
+            auto even = float(sampleData[0]) * multiplier;
+            auto odd = float(sampleData[sampleIncrement]) * multiplier;
+
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                even = std::fmaxf(std::fminf(even, 1.0f), -1.0f);
+                odd = std::fmaxf(std::fminf(odd, 1.0f), -1.0f);
+            }
+
+            auto j = bitReversal[i];
+            fftReal[j] = even;
+            fftImag[j] = odd;
+            averageIntensity += even * even + odd * odd;
+            sampleData += pairIncrement;
         }
 
-        auto reversedIndex = 0;
-        auto step = 0;
+        return averageIntensity / float(numPairs << 1);
+    }
 
-        for (auto i = 0; i < NUM_SAMPLES; ++i)
+    /// @brief Performs the in-place N / 2 point complex FFT on the bit-reversed data.
+    void Transform()
+    {
+        const auto size = int(GetSize() >> 1);
+        const auto twiddleReal = tables->twiddleReal.data();
+        const auto twiddleImag = tables->twiddleImag.data();
+        auto real = fftReal.data();
+        auto imag = fftImag.data();
+
+        // First stage has trivial twiddles
+        for (auto i = 0; i < size; i += 2)
         {
-            bitReversalTable[i] = reversedIndex;
-            for (step = HALF_SAMPLES; step && (step <= reversedIndex); step >>= 1)
-                reversedIndex -= step;
-            reversedIndex += step;
+            auto tr = real[i + 1];
+            auto ti = imag[i + 1];
+            real[i + 1] = real[i] - tr;
+            imag[i + 1] = imag[i] - ti;
+            real[i] += tr;
+            imag[i] += ti;
         }
 
-        for (auto i = HALF_SAMPLES / 4 + 1; i <= HALF_SAMPLES / 2; ++i)
+        for (auto half = 2; half < size; half <<= 1)
         {
-            sinCosTable[i][0] = sinCosTable[HALF_SAMPLES / 2 - i][1];
-            sinCosTable[i][1] = sinCosTable[HALF_SAMPLES / 2 - i][0];
+            const auto stageTwiddleReal = twiddleReal + (half - 2);
+            const auto stageTwiddleImag = twiddleImag + (half - 2);
+
+            for (auto start = 0; start < size; start += half << 1)
+                Butterflies(real + start, imag + start, real + start + half, imag + start + half, stageTwiddleReal, stageTwiddleImag, half);
         }
+    }
 
-        for (auto i = HALF_SAMPLES / 2 + 1; i < HALF_SAMPLES; ++i)
+    /// @brief Runs count radix-2 butterflies on one block of a stage: (a, b) -> (a + w * b, a - w * b).
+    /// The halves and the twiddles never overlap. Saying so with __restrict is what lets the compiler vectorize the loop,
+    /// since otherwise a store to one half could change the twiddles or the other half.
+    static void Butterflies(float *__restrict ar, float *__restrict ai, float *__restrict br, float *__restrict bi, const float *__restrict wr, const float *__restrict wi, int count)
+    {
+        for (auto j = 0; j < count; ++j)
         {
-            sinCosTable[i][0] = -sinCosTable[HALF_SAMPLES - i][0];
-            sinCosTable[i][1] = sinCosTable[HALF_SAMPLES - i][1];
+            auto tr = br[j] * wr[j] - bi[j] * wi[j];
+            auto ti = br[j] * wi[j] + bi[j] * wr[j];
+            br[j] = ar[j] - tr;
+            bi[j] = ai[j] - ti;
+            ar[j] += tr;
+            ai[j] += ti;
         }
     }
 
-    ~AudioAnalyzerFFT() = default;
-    AudioAnalyzerFFT(const AudioAnalyzerFFT &) = delete;
-    AudioAnalyzerFFT &operator=(const AudioAnalyzerFFT &) = delete;
+    /// @brief Splits the packed complex FFT into the spectrum of the real input and calls sink(k, real, imag) for k = 0 .. N / 2.
+    template <typename F>
+    void SplitRealSpectrum(F &&sink)
+    {
+        const auto size = int(GetSize() >> 1);
+        const auto splitTwiddleReal = tables->splitTwiddleReal.data();
+        const auto splitTwiddleImag = tables->splitTwiddleImag.data();
+
+        sink(0, fftReal[0] + fftImag[0], 0.0f);
 
-    static inline constexpr int32_t MultiplyShift29(int32_t a, int32_t b)
+        for (auto k = 1; k < size; ++k)
+        {
+            auto zr = fftReal[k], zi = fftImag[k];
+            auto cr = fftReal[size - k], ci = -fftImag[size - k];
+
+            auto er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);   // even part
+            auto orr = 0.5f * (zi - ci), oi = -0.5f * (zr - cr); // odd part: (Z - conj) / 2i
+
+            auto wr = splitTwiddleReal[k], wi = splitTwiddleImag[k];
+
+            sink(k, er + orr * wr - oi * wi, ei + orr * wi + oi * wr);
+        }
+
+        sink(size, fftReal[0] - fftImag[0], 0.0f);
+    }
+
+    /// @brief Legacy amplitude output: bins 1 .. N / 2 scaled to 16-bit sample units and weighted by sqrt(bin).
+    void StoreAmplitudes(uint16_t *amplitudeArray, float multiplier)
+    {
+        const auto scale = multiplier / float(GetSize());
+
+        SplitRealSpectrum([&](int k, float realPart, float imagPart)
+                          {
+                              if (k)
+                              {
+                                  auto amplitude = std::sqrt((realPart * realPart + imagPart * imagPart) * float(k)) * scale;
+                                  amplitudeArray[k - 1] = uint16_t(std::fmin(amplitude, 65535.0f));
+                              } });
+    }
+
+    std::shared_ptr<const Tables> tables;
+    std::vector<float> fftReal;
+    std::vector<float> fftImag;
+};
+
+/// @brief Streaming short-time Fourier transform.
+/// Audio of any length is pushed into a preallocated ring buffer. Every hopSize samples (once the first full window is
+/// available) the last N samples are windowed and transformed, and the spectrum is appended to a small preallocated queue.
+class AudioAnalyzerSTFT
+{
+public:
+    enum Window
+    {
+        WINDOW_RECTANGULAR = 0,
+        WINDOW_HANN,
+        WINDOW_BLACKMAN_HARRIS,
+        WINDOW_COUNT
+    };
+
+    static constexpr auto QUEUE_CAPACITY = 16; // spectra older than this are dropped if they are not popped in time
+
+    /// @brief Creates a streaming STFT.
+    /// @param bitDepth The bit depth representing the FFT size.
+    /// @param hopSize The number of samples between two spectra. 0 selects N / 2.
+    /// @param window The analysis window (see Window).
+    /// @param asPower If true, the spectra contain power instead of magnitudes.
+    AudioAnalyzerSTFT(int bitDepth, uint32_t hopSize, int window, bool asPower)
+        : fft(bitDepth), asPower(asPower), writePosition(0), filled(0), hopCounter(0), queueHead(0), queueCount(0)
+    {
+        const auto size = fft.GetSize();
+
+        this->hopSize = hopSize ? std::min(hopSize, size) : size >> 1;
+        this->window = GetWindow(window, fft.GetBitDepth());
+        ring.resize(size);
+        frame.resize(size);
+        queue.resize(size_t(QUEUE_CAPACITY) * fft.GetBins());
+    }
+
+    AudioAnalyzerSTFT() = delete;
+    AudioAnalyzerSTFT(const AudioAnalyzerSTFT &) = delete;
+    AudioAnalyzerSTFT &operator=(const AudioAnalyzerSTFT &) = delete;
+
+    uint32_t GetBins() const { return fft.GetBins(); }
+
+    uint32_t GetAvailable() const { return queueCount; }
+
+    void Reset()
+    {
+        std::fill(ring.begin(), ring.end(), 0.0f);
+        writePosition = filled = hopCounter = 0;
+        queueHead = queueCount = 0;
+    }
+
+    /// @brief Pushes samples into the analyzer.
+    /// @param sampleData The samples.
+    /// @param samples The number of samples to read from sampleData.
+    /// @param sampleIncrement The number to use to get to the next sample in sampleData. For stereo interleaved samples use 2, else 1.
+    /// @return The number of spectra that are ready to be popped.
+    uint32_t Push(const float *sampleData, uint32_t samples, int sampleIncrement)
+    {
+        const auto size = uint32_t(ring.size());
+
+        while (samples)
+        {
+            // Copy as much as we can before we either wrap or hit the next hop
+            auto count = std::min({samples, size - writePosition, hopSize - hopCounter});
+
+            for (uint32_t i = 0; i < count; i++, sampleData += sampleIncrement)
+                ring[writePosition + i] = *sampleData;
+
+            writePosition = (writePosition + count) & (size - 1);
+            filled = std::min(filled + count, size);
+            hopCounter += count;
+            samples -= count;
+
+            if (hopCounter == hopSize)
+            {
+                hopCounter = 0;
+
+                if (filled == size)
+                    Analyze();
+            }
+        }
+
+        return queueCount;
+    }
+
+    /// @brief Removes the oldest spectrum from the queue.
+    /// @param spectrumArray The array where the N / 2 + 1 bins are stored.
+    /// @return True if a spectrum was copied, false if the queue was empty.
+    bool Pop(float *spectrumArray)
+    {
+        if (!queueCount)
+            return false;
+
+        const auto bins = fft.GetBins();
+        std::copy_n(queue.data() + size_t(queueHead) * bins, bins, spectrumArray);
+        queueHead = (queueHead + 1) % QUEUE_CAPACITY;
+        --queueCount;
+
+        return true;
+    }
+
+    /// @brief Returns the shared window of a type and size. Windows are normalized by their coherent gain so that spectrum magnitudes are comparable to the rectangular window.
+    static std::shared_ptr<const std::vector<float>> GetWindow(int type, int bitDepth)
+    {
+        static std::mutex cacheMutex;
+        static std::array<std::array<std::shared_ptr<const std::vector<float>>, AudioAnalyzerFFT::FFT_POWER_MAX + 1>, WINDOW_COUNT> cache;
+
+        type = std::clamp(type, int(WINDOW_RECTANGULAR), int(WINDOW_COUNT) - 1);
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        auto &entry = cache[type][bitDepth];
+        if (!entry)
+        {
+            const auto size = size_t(1) << bitDepth;
+            std::vector<float> w(size);
+            auto sum = 0.0;
+
+            for (size_t i = 0; i < size; i++)
+            {
+                auto x = (2.0 * M_PI * double(i)) / double(size); // periodic window
+
+                switch (type)
+                {
+                case WINDOW_HANN:
+                    w[i] = float(0.5 - 0.5 * std::cos(x));
+                    break;
+
+                case WINDOW_BLACKMAN_HARRIS:
+                    w[i] = float(0.35875 - 0.48829 * std::cos(x) + 0.14128 * std::cos(2.0 * x) - 0.01168 * std::cos(3.0 * x));
+                    break;
+
+                default:
+                    w[i] = 1.0f;
+                }
+
+                sum += w[i];
+            }
+
+            auto gain = float(double(size) / sum);
+            for (auto &v : w)
+                v *= gain;
+
+            entry = std::make_shared<const std::vector<float>>(std::move(w));
+        }
+
+        return entry;
+    }
+
+private:
+    void Analyze()
     {
-        return int32_t((int64_t(a) * int64_t(b)) >> 29);
+        const auto size = uint32_t(ring.size());
+        const auto &w = *window;
+        const auto tail = size - writePosition;
+
+        // Unroll the ring (oldest sample first) and apply the window
+        for (uint32_t i = 0; i < tail; i++)
+            frame[i] = ring[writePosition + i] * w[i];
+
+        for (uint32_t i = tail; i < size; i++)
+            frame[i] = ring[i - tail] * w[i];
+
+        if (queueCount == QUEUE_CAPACITY)
+        {
+            // Drop the oldest spectrum
+            queueHead = (queueHead + 1) % QUEUE_CAPACITY;
+            --queueCount;
+        }
+
+        auto slot = (queueHead + queueCount) % QUEUE_CAPACITY;
+        fft.DoFFT(queue.data() + size_t(slot) * fft.GetBins(), frame.data(), 1, asPower);
+        ++queueCount;
     }
 
-    static void CalculateFFT(int32_t *currentSample, int32_t *currentSinCos, uint32_t distance)
+    AudioAnalyzerFFT fft;
+    std::shared_ptr<const std::vector<float>> window;
+    bool asPower;
+    uint32_t hopSize;
+    std::vector<float> ring;
+    std::vector<float> frame;
+    std::vector<float> queue;
+    uint32_t writePosition;
+    uint32_t filled;
+    uint32_t hopCounter;
+    uint32_t queueHead;
+    uint32_t queueCount;
+};
+
+/// @brief Maps FFT bins to a small number of perceptual bands (log-spaced, 1/3-octave or mel) for spectrum displays.
+/// A map depends only on the scale, sample rate, FFT size and band count, so it is built once and cached. The cache keeps
+/// the MAP_CACHE_SIZE most recently used maps, so resizing a display that asks for one band per pixel does not pile up maps.
+class AudioAnalyzerBands
+{
+public:
+    enum Scale
+    {
+        SCALE_LOG = 0,
+        SCALE_THIRD_OCTAVE,
+        SCALE_MEL,
+        SCALE_COUNT
+    };
+
+    static constexpr auto FREQUENCY_MIN = 20.0;
+    static constexpr auto FREQUENCY_MAX = 20000.0;
+    static constexpr size_t MAP_CACHE_SIZE = 8;
+
+    /// @brief One band. Bins [first, last) are reduced with max(). If the band is narrower than a bin, first == last and
+    /// the value is interpolated between bins first - 1 and first using weight.
+    struct Band
+    {
+        uint32_t first;
+        uint32_t last;
+        float weight;
+    };
+
+    typedef std::vector<Band> Map;
+
+    /// @brief Returns the cached map for the given parameters, building it on first use.
+    /// @param scale The band scale (see Scale).
+    /// @param sampleRate The sample rate of the analyzed audio.
+    /// @param bitDepth The bit depth representing the FFT size.
+    /// @param bands The requested number of bands. For SCALE_THIRD_OCTAVE this is an upper limit (0 = all bands in range).
+    static std::shared_ptr<const Map> GetMap(int scale, uint32_t sampleRate, int bitDepth, uint32_t bands)
     {
-        auto realPart = currentSample[0] - currentSample[distance + 0];
-        currentSample[0] = (currentSample[0] + currentSample[distance + 0]) >> 1;
+        typedef std::tuple<int, uint32_t, int, uint32_t> Key;
 
-        auto imagPart = currentSample[1] - currentSample[distance + 1];
-        currentSample[1] = (currentSample[1] + currentSample[distance + 1]) >> 1;
+        static std::mutex cacheMutex;
+        static std::list<std::pair<Key, std::shared_ptr<const Map>>> cache; // most recently used first
 
-        currentSample[distance + 0] = MultiplyShift29(realPart, currentSinCos[0]) - MultiplyShift29(imagPart, currentSinCos[1]);
-        currentSample[distance + 1] = MultiplyShift29(realPart, currentSinCos[1]) + MultiplyShift29(imagPart, currentSinCos[0]);
+        scale = std::clamp(scale, int(SCALE_LOG), int(SCALE_COUNT) - 1);
+        bitDepth = AudioAnalyzerFFT::ClampBitDepth(bitDepth);
+        const auto key = std::make_tuple(scale, sampleRate, bitDepth, bands);
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        auto entry = std::find_if(cache.begin(), cache.end(), [&key](const auto &e)
+                                  { return e.first == key; });
+
+        if (entry != cache.end())
+            cache.splice(cache.begin(), cache, entry);
+        else
+        {
+            // Callers hold on to the evicted map through their shared_ptr for as long as they use it
+            if (cache.size() >= MAP_CACHE_SIZE)
+                cache.pop_back();
+
+            cache.emplace_front(key, std::make_shared<const Map>(BuildMap(scale, sampleRate, bitDepth, bands)));
+        }
+
+        return cache.front().second;
     }
 
-    static void PerformButterflyOperation(int32_t (*data)[2], int stage)
+    /// @brief Reduces a spectrum to bands in a single pass.
+    /// @param bandArray Receives one value per band.
+    /// @param binArray The spectrum bins.
+    /// @param binCount The number of values in binArray.
+    /// @param binOffset The FFT bin number of binArray[0] (1 for the legacy amplitude arrays that start at bin 1).
+    template <typename T>
+    static void Aggregate(const Map &map, float *bandArray, const T *binArray, uint32_t binCount, uint32_t binOffset)
     {
-        auto lastStageData = data[1 << stage];
-        int32_t currentSinCos[2];
-        int32_t *currentSample;
+        auto fetch = [&](uint32_t bin) -> float
+        {
+            return bin >= binOffset && bin - binOffset < binCount ? float(binArray[bin - binOffset]) : 0.0f;
+        };
 
-        for (auto i = FFT_POWER - stage; i < FFT_POWER; ++i)
+        for (size_t b = 0; b < map.size(); b++)
         {
-            const auto stepSize = HALF_SAMPLES >> i;
-            const auto distance = 2 * stepSize;
+            auto &band = map[b];
 
-            for (auto j = 0; j < stepSize; ++j)
+            if (band.first < band.last)
             {
-                currentSinCos[0] = sinCosTable[j << i][0];
-                currentSinCos[1] = sinCosTable[j << i][1];
+                auto first = std::max(band.first, binOffset) - binOffset;
+                auto last = std::min(band.last - binOffset, binCount);
+                auto value = 0.0f;
 
-                for (currentSample = data[j]; currentSample < lastStageData; currentSample += 2 * distance)
-                    CalculateFFT(currentSample, currentSinCos, distance);
+                for (auto i = first; i < last; i++)
+                    value = std::fmax(value, float(binArray[i]));
+
+                bandArray[b] = value;
+            }
+            else
+            {
+                auto lo = fetch(band.first - 1);
+                bandArray[b] = lo + (fetch(band.first) - lo) * band.weight;
             }
         }
     }
 
-    // Declare and define these inside the class.
-    static inline uint16_t bitReversalTable[NUM_SAMPLES];
-    static inline int32_t sinCosTable[HALF_SAMPLES][2];
-    static inline int32_t fftBuffer[NUM_SAMPLES][2];
+private:
+    static Map BuildMap(int scale, uint32_t sampleRate, int bitDepth, uint32_t bands)
+    {
+        const auto size = double(1u << bitDepth);
+        const auto nyquistBin = uint32_t(size) >> 1;
+        const auto binWidth = double(sampleRate) / size;
+        const auto fMin = std::max(FREQUENCY_MIN, binWidth);
+        const auto fMax = std::min(FREQUENCY_MAX, double(sampleRate) / 2.0);
+
+        std::vector<double> edges;
+
+        if (fMax > fMin)
+        {
+            switch (scale)
+            {
+            case SCALE_THIRD_OCTAVE:
+            {
+                // Nominal centers are 1 kHz * 2^(n / 3). Edges are 1/6 octave either side of the center.
+                auto first = int(std::ceil(3.0 * std::log2(fMin / 1000.0)));
+                auto last = int(std::floor(3.0 * std::log2(fMax / 1000.0)));
+
+                if (bands)
+                    last = std::min(last, first + int(bands) - 1);
+
+                for (auto n = first; n <= last + 1; n++)
+                    edges.push_back(1000.0 * std::pow(2.0, (double(n) - 0.5) / 3.0));
+            }
+            break;
+
+            case SCALE_MEL:
+            {
+                auto toMel = [](double f)
+                { return 2595.0 * std::log10(1.0 + f / 700.0); };
+                auto melMin = toMel(fMin), melMax = toMel(fMax);
+
+                for (uint32_t i = 0; bands and i <= bands; i++)
+                    edges.push_back(700.0 * (std::pow(10.0, (melMin + (melMax - melMin) * i / bands) / 2595.0) - 1.0));
+            }
+            break;
+
+            default:
+                for (uint32_t i = 0; bands and i <= bands; i++)
+                    edges.push_back(fMin * std::pow(fMax / fMin, double(i) / double(bands)));
+            }
+        }
+
+        Map map;
+
+        for (size_t i = 0; i + 1 < edges.size(); i++)
+        {
+            auto lo = edges[i] / binWidth;
+            auto hi = edges[i + 1] / binWidth;
+
+            Band band;
+            band.first = std::min(uint32_t(std::ceil(lo)), nyquistBin + 1);
+            band.last = std::min(uint32_t(std::ceil(hi)), nyquistBin + 1);
+            band.weight = 0.0f;
+
+            if (band.first >= band.last)
+            {
+                // The band falls between two bins so interpolate at its center
+                auto center = std::min((lo + hi) / 2.0, double(nyquistBin));
+                band.first = band.last = uint32_t(center) + 1;
+                band.weight = float(center - std::floor(center));
+            }
+
+            map.push_back(band);
+        }
+
+        return map;
+    }
 };
 
+/// @brief Returns an FFT object of the requested size that is private to the calling thread.
+/// This is what makes the flat C API below safe to call from multiple threads.
+/// @param bitDepth The bit depth representing the number of samples.
+/// @param slot The slot to use. Batch calls use one slot per channel so that each channel gets its own working buffers.
+static AudioAnalyzerFFT &__AudioAnalyzerFFT_GetThreadInstance(int bitDepth, size_t slot = 0)
+{
+    static thread_local std::vector<std::array<std::unique_ptr<AudioAnalyzerFFT>, AudioAnalyzerFFT::FFT_POWER_MAX + 1>> instances;
+
+    bitDepth = AudioAnalyzerFFT::ClampBitDepth(bitDepth);
+
+    if (slot >= instances.size())
+        instances.resize(slot + 1);
+
+    auto &instance = instances[slot][bitDepth];
+    if (!instance)
+        instance = std::make_unique<AudioAnalyzerFFT>(bitDepth);
+
+    return *instance;
+}
+
+static WorkerPool g_AudioAnalyzerFFTWorkers;
+
+/// @brief Runs work(channel) for each channel. If parallel is true, the channels are shared between the persistent worker
+/// threads and the calling thread.
+template <typename F>
+static void __AudioAnalyzerFFT_ForEachChannel(int channels, bool parallel, F &&work)
+{
+    if (!parallel or channels < 2)
+    {
+        for (auto c = 0; c < channels; c++)
+            work(c);
+
+        return;
+    }
+
+    g_AudioAnalyzerFFTWorkers.Run(size_t(channels), [&work](size_t c)
+                                  { work(int(c)); });
+}
+
+/// @brief Creates a new FFT object that owns its working buffers. Objects can be used concurrently from different threads.
+/// @param bitDepth The bit depth representing the number of samples (2 - 16).
+/// @return A pointer to the new FFT object.
+uintptr_t AudioAnalyzerFFT_Create(int bitDepth)
+{
+    return reinterpret_cast<uintptr_t>(new AudioAnalyzerFFT(bitDepth));
+}
+
+/// @brief Deletes an FFT object created using AudioAnalyzerFFT_Create().
+/// @param fft A valid pointer to an FFT object.
+void AudioAnalyzerFFT_Destroy(uintptr_t fft)
+{
+    delete reinterpret_cast<AudioAnalyzerFFT *>(fft);
+}
+
+/// @brief Computes the magnitude or power spectrum using an FFT object created using AudioAnalyzerFFT_Create().
+/// @param fft A valid pointer to an FFT object.
+/// @param spectrumArray The array where the resulting N / 2 + 1 bins are stored. Magnitudes are scaled by 2 / N (1 / N for DC and Nyquist).
+/// @param sampleData An array of floating-point (FP32) samples.
+/// @param sampleIncrement The number to use to get to the next sample in sampleData. For stereo interleaved samples use 2, else 1.
+/// @param asPower If this is QB_TRUE, the power (squared magnitude) is returned for each bin instead of the magnitude.
+/// @return Returns the average intensity level of the audio signal.
+float AudioAnalyzerFFT_Execute(uintptr_t fft, float *spectrumArray, const float *sampleData, int sampleIncrement, qb_bool asPower)
+{
+    return reinterpret_cast<AudioAnalyzerFFT *>(fft)->DoFFT(spectrumArray, sampleData, sampleIncrement, bool(asPower));
+}
+
 /// @brief FFT for 16-bit integer samples. This computes the amplitude spectrum for the positive frequencies only.
 /// @param amplitudeArray The array where the resulting FFT amplitude data is stored.
 /// @param sampleData An array of 16-bit samples.
@@ -183,7 +736,7 @@ private:
 /// @return Returns the average intensity level of the audio signal.
 float AudioAnalyzerFFT_DoInteger(uint16_t *amplitudeArray, const int16_t *sampleData, int sampleIncrement, int bitDepth)
 {
-    return AudioAnalyzerFFT::Instance().DoFFT(amplitudeArray, sampleData, sampleIncrement, bitDepth);
+    return __AudioAnalyzerFFT_GetThreadInstance(bitDepth).DoFFT(amplitudeArray, sampleData, sampleIncrement);
 }
 
 /// @brief FFT for floating-point samples. This computes the amplitude spectrum for the positive frequencies only.
@@ -194,5 +747,148 @@ float AudioAnalyzerFFT_DoInteger(uint16_t *amplitudeArray, const int16_t *sample
 /// @return Returns the average intensity level of the audio signal.
 float AudioAnalyzerFFT_DoSingle(uint16_t *amplitudeArray, const float *sampleData, int sampleIncrement, int bitDepth)
 {
-    return AudioAnalyzerFFT::Instance().DoFFT(amplitudeArray, sampleData, sampleIncrement, bitDepth);
+    return __AudioAnalyzerFFT_GetThreadInstance(bitDepth).DoFFT(amplitudeArray, sampleData, sampleIncrement);
+}
+
+/// @brief Floating-point FFT for floating-point samples. This computes the magnitude or power spectrum for the positive frequencies (N / 2 + 1 bins).
+/// @param spectrumArray The array where the resulting N / 2 + 1 bins are stored. Magnitudes are scaled by 2 / N (1 / N for DC and Nyquist).
+/// @param sampleData An array of floating-point (FP32) samples.
+/// @param sampleIncrement The number to use to get to the next sample in sampleData. For stereo interleaved samples use 2, else 1.
+/// @param bitDepth The bit depth representing the number of samples. So if bitDepth = 9, then samples = 1 << 9 or 512.
+/// @param asPower If this is QB_TRUE, the power (squared magnitude) is returned for each bin instead of the magnitude.
+/// @return Returns the average intensity level of the audio signal.
+float AudioAnalyzerFFT_DoSingleSpectrum(float *spectrumArray, const float *sampleData, int sampleIncrement, int bitDepth, qb_bool asPower)
+{
+    return __AudioAnalyzerFFT_GetThreadInstance(bitDepth).DoFFT(spectrumArray, sampleData, sampleIncrement, bool(asPower));
+}
+
+/// @brief Computes the legacy amplitude spectrum of every channel of an interleaved floating-point buffer.
+/// @param amplitudeArray The array where the resulting FFT amplitude data is stored. This must have room for (N / 2) * channels values laid out channel after channel.
+/// @param intensityArray The array where the average intensity of each channel is stored. This must have room for channels values.
+/// @param sampleData An array of interleaved floating-point (FP32) samples.
+/// @param channels The number of interleaved channels.
+/// @param bitDepth The bit depth representing the number of samples per channel.
+/// @param parallel If this is QB_TRUE, channels are transformed in parallel on worker threads.
+void AudioAnalyzerFFT_DoSingleInterleaved(uint16_t *amplitudeArray, float *intensityArray, const float *sampleData, int channels, int bitDepth, qb_bool parallel)
+{
+    if (channels < 1)
+        return;
+
+    // Create the per-channel objects on this thread so that the workers only ever touch their own object
+    std::vector<AudioAnalyzerFFT *> ffts(channels);
+    for (auto c = 0; c < channels; c++)
+        ffts[c] = &__AudioAnalyzerFFT_GetThreadInstance(bitDepth, c);
+
+    // The layout of the output follows the requested size, even if the FFT size had to be clamped
+    const auto amplitudes = size_t(1) << (std::max(bitDepth, AudioAnalyzerFFT::FFT_POWER_MIN) - 1);
+
+    __AudioAnalyzerFFT_ForEachChannel(channels, bool(parallel), [&](int c)
+                                      { intensityArray[c] = ffts[c]->DoFFT(amplitudeArray + size_t(c) * amplitudes, sampleData + c, channels); });
+}
+
+/// @brief Computes the magnitude or power spectrum of every channel of an interleaved floating-point buffer.
+/// @param spectrumArray The array where the resulting bins are stored. This must have room for (N / 2 + 1) * channels values laid out channel after channel. Magnitudes are scaled by 2 / N (1 / N for DC and Nyquist).
+/// @param intensityArray The array where the average intensity of each channel is stored. This must have room for channels values.
+/// @param sampleData An array of interleaved floating-point (FP32) samples.
+/// @param channels The number of interleaved channels.
+/// @param bitDepth The bit depth representing the number of samples per channel.
+/// @param asPower If this is QB_TRUE, the power (squared magnitude) is returned for each bin instead of the magnitude.
+/// @param parallel If this is QB_TRUE, channels are transformed in parallel on worker threads.
+void AudioAnalyzerFFT_DoSingleSpectrumInterleaved(float *spectrumArray, float *intensityArray, const float *sampleData, int channels, int bitDepth, qb_bool asPower, qb_bool parallel)
+{
+    if (channels < 1)
+        return;
+
+    std::vector<AudioAnalyzerFFT *> ffts(channels);
+    for (auto c = 0; c < channels; c++)
+        ffts[c] = &__AudioAnalyzerFFT_GetThreadInstance(bitDepth, c);
+
+    const auto bins = (size_t(1) << (std::max(bitDepth, AudioAnalyzerFFT::FFT_POWER_MIN) - 1)) + 1;
+
+    __AudioAnalyzerFFT_ForEachChannel(channels, bool(parallel), [&](int c)
+                                      { intensityArray[c] = ffts[c]->DoFFT(spectrumArray + size_t(c) * bins, sampleData + c, channels, bool(asPower)); });
+}
+
+/// @brief Creates a streaming STFT analyzer.
+/// @param bitDepth The bit depth representing the FFT size.
+/// @param hopSize The number of samples between two spectra. 0 selects half the FFT size.
+/// @param window The analysis window (0 = rectangular, 1 = Hann, 2 = Blackman-Harris).
+/// @param asPower If this is QB_TRUE, the spectra contain power instead of magnitudes.
+/// @return A pointer to the new STFT analyzer.
+uintptr_t AudioAnalyzerSTFT_Create(int bitDepth, uint32_t hopSize, int32_t window, qb_bool asPower)
+{
+    return reinterpret_cast<uintptr_t>(new AudioAnalyzerSTFT(bitDepth, hopSize, window, bool(asPower)));
+}
+
+/// @brief Deletes an STFT analyzer created using AudioAnalyzerSTFT_Create().
+/// @param stft A valid pointer to an STFT analyzer.
+void AudioAnalyzerSTFT_Destroy(uintptr_t stft)
+{
+    delete reinterpret_cast<AudioAnalyzerSTFT *>(stft);
+}
+
+/// @brief Clears the sample history and any pending spectra.
+/// @param stft A valid pointer to an STFT analyzer.
+void AudioAnalyzerSTFT_Reset(uintptr_t stft)
+{
+    reinterpret_cast<AudioAnalyzerSTFT *>(stft)->Reset();
+}
+
+/// @brief Returns the number of bins in each spectrum (N / 2 + 1).
+/// @param stft A valid pointer to an STFT analyzer.
+uint32_t AudioAnalyzerSTFT_GetBins(uintptr_t stft)
+{
+    return reinterpret_cast<AudioAnalyzerSTFT *>(stft)->GetBins();
+}
+
+/// @brief Pushes samples into the STFT analyzer.
+/// @param stft A valid pointer to an STFT analyzer.
+/// @param sampleData An array of floating-point (FP32) samples.
+/// @param samples The number of samples to read from sampleData (i.e. frames for interleaved data).
+/// @param sampleIncrement The number to use to get to the next sample in sampleData. For stereo interleaved samples use 2, else 1.
+/// @return The number of spectra that are ready to be popped.
+uint32_t AudioAnalyzerSTFT_Push(uintptr_t stft, const float *sampleData, uint32_t samples, int sampleIncrement)
+{
+    return reinterpret_cast<AudioAnalyzerSTFT *>(stft)->Push(sampleData, samples, sampleIncrement);
+}
+
+/// @brief Removes the oldest pending spectrum.
+/// @param stft A valid pointer to an STFT analyzer.
+/// @param spectrumArray The array where the N / 2 + 1 bins are stored.
+/// @return QB_TRUE if a spectrum was returned, QB_FALSE if none was pending.
+qb_bool AudioAnalyzerSTFT_Pop(uintptr_t stft, float *spectrumArray)
+{
+    return TO_QB_BOOL(reinterpret_cast<AudioAnalyzerSTFT *>(stft)->Pop(spectrumArray));
+}
+
+/// @brief Reduces a floating-point spectrum (as returned by AudioAnalyzerFFT_DoSingleSpectrum) to log-spaced, 1/3-octave or mel bands.
+/// @param bandArray The array that receives the band values. This must have room for bands values.
+/// @param spectrumArray The N / 2 + 1 spectrum bins.
+/// @param sampleRate The sample rate of the analyzed audio.
+/// @param bitDepth The bit depth representing the FFT size.
+/// @param scale The band scale (0 = log, 1 = 1/3-octave, 2 = mel).
+/// @param bands The number of bands. For 1/3-octave bands this is an upper limit.
+/// @return The number of bands written to bandArray.
+uint32_t AudioAnalyzerFFT_AggregateBands(float *bandArray, const float *spectrumArray, uint32_t sampleRate, int bitDepth, int32_t scale, uint32_t bands)
+{
+    auto map = AudioAnalyzerBands::GetMap(scale, sampleRate, bitDepth, bands);
+    AudioAnalyzerBands::Aggregate(*map, bandArray, spectrumArray, (1u << (AudioAnalyzerFFT::ClampBitDepth(bitDepth) - 1)) + 1, 0);
+
+    return uint32_t(map->size());
+}
+
+/// @brief Reduces a legacy amplitude array (as returned by AudioAnalyzerFFT_DoSingle and AudioAnalyzerFFT_DoInteger) to log-spaced, 1/3-octave or mel bands.
+/// @param bandArray The array that receives the band values. This must have room for bands values.
+/// @param amplitudeArray The N / 2 amplitudes (bins 1 .. N / 2).
+/// @param sampleRate The sample rate of the analyzed audio.
+/// @param bitDepth The bit depth representing the FFT size.
+/// @param scale The band scale (0 = log, 1 = 1/3-octave, 2 = mel).
+/// @param bands The number of bands. For 1/3-octave bands this is an upper limit.
+/// @return The number of bands written to bandArray.
+uint32_t AudioAnalyzerFFT_AggregateBandsInteger(float *bandArray, const uint16_t *amplitudeArray, uint32_t sampleRate, int bitDepth, int32_t scale, uint32_t bands)
+{
+    auto map = AudioAnalyzerBands::GetMap(scale, sampleRate, bitDepth, bands);
+    AudioAnalyzerBands::Aggregate(*map, bandArray, amplitudeArray, 1u << (AudioAnalyzerFFT::ClampBitDepth(bitDepth) - 1), 1);
+
+    return uint32_t(map->size());
 }
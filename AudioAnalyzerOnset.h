@@ -0,0 +1,280 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Onset and tempo detection for audio spectrum analyzers
+// Copyright (c) 2024 Samuel Gomes
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Types.h"
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/// @brief Incremental onset detector and tempo estimator.
+/// Each pushed magnitude spectrum is log-compressed and compared with the previous one. The half-wave rectified sum of
+/// the differences (spectral flux) is compared against an adaptive threshold (a scaled moving average of recent flux) to
+/// flag onsets. The flux above the moving average is kept as an onset envelope whose autocorrelation gives the tempo.
+/// Spectra must be pushed at a steady rate (e.g. from AudioAnalyzerSTFT with a fixed hop size).
+class AudioAnalyzerOnset
+{
+public:
+    static constexpr auto COMPRESSION = 100.0f;      // log(1 + COMPRESSION * magnitude)
+    static constexpr auto THRESHOLD_SECONDS = 0.25f; // moving average window for the adaptive threshold
+    static constexpr auto THRESHOLD_MULTIPLIER = 1.5f;
+    static constexpr auto THRESHOLD_OFFSET = 0.01f;  // keeps silence from triggering onsets
+    static constexpr auto MIN_INTERVAL_SECONDS = 0.05f;
+    static constexpr auto HISTORY_SECONDS = 6.0f;    // onset envelope length used for the tempo
+    static constexpr auto TEMPO_MIN = 60.0f;         // BPM
+    static constexpr auto TEMPO_MAX = 200.0f;        // BPM
+    static constexpr auto TEMPO_PREFERRED = 120.0f;  // BPM, center of the perceptual weighting
+    static constexpr auto TEMPO_WEIGHT_OCTAVES = 1.5f;
+    static constexpr auto TEMPO_EVEN_RATIO = 0.95f;  // the faster of two octaves wins if its correlation is this close
+
+    /// @brief Creates a detector.
+    /// @param bins The number of bins in each spectrum.
+    /// @param frameRate The number of spectra pushed per second (sample rate / hop size).
+    AudioAnalyzerOnset(uint32_t bins, float frameRate)
+        : bins(std::max(bins, 1u)), frameRate(std::max(frameRate, 1.0f))
+    {
+        previous.resize(this->bins);
+        current.resize(this->bins);
+        fluxHistory.resize(std::max(uint32_t(THRESHOLD_SECONDS * this->frameRate), 1u));
+        envelope.resize(std::max(uint32_t(HISTORY_SECONDS * this->frameRate), 2u));
+        minInterval = uint32_t(MIN_INTERVAL_SECONDS * this->frameRate);
+
+        Reset();
+    }
+
+    AudioAnalyzerOnset() = delete;
+    AudioAnalyzerOnset(const AudioAnalyzerOnset &) = delete;
+    AudioAnalyzerOnset &operator=(const AudioAnalyzerOnset &) = delete;
+
+    void Reset()
+    {
+        std::fill(previous.begin(), previous.end(), 0.0f);
+        std::fill(fluxHistory.begin(), fluxHistory.end(), 0.0f);
+        std::fill(envelope.begin(), envelope.end(), 0.0f);
+        fluxSum = flux = lastFlux = threshold = 0.0f;
+        fluxPosition = envelopePosition = 0;
+        frames = 0;
+        lastOnsetFrame = 0;
+        onsets = 0;
+        tempo = 0.0f;
+        isTempoDirty = false;
+        isFirst = true;
+    }
+
+    /// @brief Feeds the next magnitude spectrum.
+    /// @return True if an onset starts at this spectrum.
+    bool Push(const float *spectrum)
+    {
+        // Log-compressed spectral flux
+        for (auto k = 0u; k < bins; k++)
+            current[k] = std::log1p(COMPRESSION * std::fmax(spectrum[k], 0.0f));
+
+        auto sum = 0.0f;
+        for (auto k = 0u; k < bins; k++)
+            sum += std::fmax(current[k] - previous[k], 0.0f);
+
+        previous.swap(current);
+
+        // The very first spectrum has nothing to be compared with
+        lastFlux = flux;
+        flux = isFirst ? 0.0f : sum / bins;
+        isFirst = false;
+
+        // Adaptive threshold from the moving average of the preceding flux
+        auto average = fluxSum / fluxHistory.size();
+        threshold = average * THRESHOLD_MULTIPLIER + THRESHOLD_OFFSET;
+
+        fluxSum += flux - fluxHistory[fluxPosition];
+        fluxHistory[fluxPosition] = flux;
+        fluxPosition = (fluxPosition + 1) % fluxHistory.size();
+
+        envelope[envelopePosition] = std::fmax(flux - average, 0.0f);
+        envelopePosition = (envelopePosition + 1) % envelope.size();
+        isTempoDirty = true;
+
+        frames++;
+
+        auto isOnset = flux > threshold and flux > lastFlux and (onsets == 0 or frames - lastOnsetFrame > minInterval);
+        if (isOnset)
+        {
+            lastOnsetFrame = frames;
+            onsets++;
+        }
+
+        return isOnset;
+    }
+
+    float GetFlux() const { return flux; }
+
+    float GetThreshold() const { return threshold; }
+
+    uint64_t GetOnsetCount() const { return onsets; }
+
+    /// @brief Returns the tempo in BPM, or 0 if there is not enough history yet.
+    float GetTempo()
+    {
+        if (isTempoDirty)
+        {
+            tempo = EstimateTempo();
+            isTempoDirty = false;
+        }
+
+        return tempo;
+    }
+
+private:
+    /// @brief Picks the autocorrelation peak of the onset envelope within the tempo range, weighted towards TEMPO_PREFERRED.
+    float EstimateTempo() const
+    {
+        const auto size = uint32_t(envelope.size());
+        const auto lagMin = std::max(uint32_t(frameRate * 60.0f / TEMPO_MAX), 1u);
+        const auto lagMax = std::min(uint32_t(std::ceil(frameRate * 60.0f / TEMPO_MIN)), size - 1);
+
+        // Need at least two beat periods at the slowest tempo
+        if (frames < uint64_t(lagMax) * 2 or lagMax <= lagMin)
+            return 0.0f;
+
+        // Unroll the ring so that the correlation loops are contiguous
+        std::vector<float> e(size);
+        for (auto i = 0u; i < size; i++)
+            e[i] = envelope[(envelopePosition + i) % size];
+
+        // raw is the autocorrelation per overlapping frame; score adds the weighting towards TEMPO_PREFERRED
+        std::vector<float> raw(lagMax + 2, 0.0f), score(lagMax + 2, 0.0f);
+        for (auto lag = lagMin - 1; lag <= lagMax + 1 and lag < size; lag++)
+        {
+            auto sum = 0.0f;
+            for (auto i = lag; i < size; i++)
+                sum += e[i] * e[i - lag];
+
+            auto bpm = 60.0f * frameRate / std::max(lag, 1u);
+            auto octaves = std::log2(bpm / TEMPO_PREFERRED) / TEMPO_WEIGHT_OCTAVES;
+            raw[lag] = sum / (size - lag);
+            score[lag] = raw[lag] * std::exp(-0.5f * octaves * octaves);
+        }
+
+        // A beat period that falls between two lags spreads its peak over both, so each lag is ranked together with its
+        // stronger neighbour. Of two equal pairs, the lag with the higher score of its own wins.
+        auto pair = [](const std::vector<float> &v, uint32_t lag)
+        { return v[lag] + std::max(v[lag - 1], v[lag + 1]); };
+
+        auto best = lagMin;
+        for (auto lag = lagMin + 1; lag <= lagMax; lag++)
+        {
+            auto p = pair(score, lag), q = pair(score, best);
+            if (p > q or (p == q and score[lag] > score[best]))
+                best = lag;
+        }
+
+        if (score[best] <= 0.0f)
+            return 0.0f;
+
+        // An evenly accented pulse (e.g. a click track) correlates as strongly at twice its period as at the period itself,
+        // so only the weighting would decide. Take the faster tempo unless the slower period is clearly stronger, which
+        // means that the faster pulse is a subdivision (e.g. eighth-note hi-hats between the beats).
+        auto halfLag = best / 2;
+        if (halfLag >= lagMin)
+        {
+            auto faster = pair(raw, halfLag + 1) > pair(raw, halfLag) ? halfLag + 1 : halfLag;
+            if (pair(raw, faster) >= pair(raw, best) * TEMPO_EVEN_RATIO)
+                best = faster;
+        }
+
+        // Interpolate around the stronger lag of the pair
+        if (best < lagMax and score[best + 1] > score[best])
+            best++;
+        else if (best > lagMin and score[best - 1] > score[best])
+            best--;
+
+        // Parabolic interpolation around the peak for a sub-frame lag
+        auto a = score[best - 1], b = score[best], c = score[best + 1];
+        auto d = a - 2.0f * b + c;
+        auto offset = d < 0.0f ? std::clamp(0.5f * (a - c) / d, -0.5f, 0.5f) : 0.0f;
+
+        return 60.0f * frameRate / (float(best) + offset);
+    }
+
+    uint32_t bins;
+    float frameRate;
+    std::vector<float> previous;
+    std::vector<float> current;
+    std::vector<float> fluxHistory;
+    std::vector<float> envelope;
+    uint32_t fluxPosition;
+    uint32_t envelopePosition;
+    uint32_t minInterval;
+    float fluxSum;
+    float flux;
+    float lastFlux;
+    float threshold;
+    uint64_t frames;
+    uint64_t lastOnsetFrame;
+    uint64_t onsets;
+    float tempo;
+    bool isTempoDirty;
+    bool isFirst;
+};
+
+/// @brief Creates an onset detector.
+/// @param bins The number of bins in each spectrum (e.g. AudioAnalyzerSTFT_GetBins()).
+/// @param frameRate The number of spectra pushed per second (sample rate / hop size).
+/// @return A pointer to the detector object.
+uintptr_t AudioAnalyzerOnset_Create(uint32_t bins, float frameRate)
+{
+    return reinterpret_cast<uintptr_t>(new AudioAnalyzerOnset(bins, frameRate));
+}
+
+/// @brief Deletes a detector created using AudioAnalyzerOnset_Create().
+/// @param onset A valid pointer to a detector.
+void AudioAnalyzerOnset_Destroy(uintptr_t onset)
+{
+    delete reinterpret_cast<AudioAnalyzerOnset *>(onset);
+}
+
+/// @brief Clears the spectral history, the onset count and the tempo.
+/// @param onset A valid pointer to a detector.
+void AudioAnalyzerOnset_Reset(uintptr_t onset)
+{
+    reinterpret_cast<AudioAnalyzerOnset *>(onset)->Reset();
+}
+
+/// @brief Feeds the next magnitude spectrum to the detector.
+/// @param onset A valid pointer to a detector.
+/// @param spectrumArray A magnitude spectrum with as many bins as the detector was created with.
+/// @return True if an onset was detected.
+qb_bool AudioAnalyzerOnset_Push(uintptr_t onset, const float *spectrumArray)
+{
+    return TO_QB_BOOL(reinterpret_cast<AudioAnalyzerOnset *>(onset)->Push(spectrumArray));
+}
+
+/// @brief Returns the spectral flux of the last spectrum.
+/// @param onset A valid pointer to a detector.
+float AudioAnalyzerOnset_GetFlux(uintptr_t onset)
+{
+    return reinterpret_cast<AudioAnalyzerOnset *>(onset)->GetFlux();
+}
+
+/// @brief Returns the adaptive threshold the last flux was compared against.
+/// @param onset A valid pointer to a detector.
+float AudioAnalyzerOnset_GetThreshold(uintptr_t onset)
+{
+    return reinterpret_cast<AudioAnalyzerOnset *>(onset)->GetThreshold();
+}
+
+/// @brief Returns the number of onsets detected since the last reset.
+/// @param onset A valid pointer to a detector.
+uint64_t AudioAnalyzerOnset_GetOnsetCount(uintptr_t onset)
+{
+    return reinterpret_cast<AudioAnalyzerOnset *>(onset)->GetOnsetCount();
+}
+
+/// @brief Returns the estimated tempo in beats per minute, or 0 if it is not known yet.
+/// @param onset A valid pointer to a detector.
+float AudioAnalyzerOnset_GetTempo(uintptr_t onset)
+{
+    return reinterpret_cast<AudioAnalyzerOnset *>(onset)->GetTempo();
+}
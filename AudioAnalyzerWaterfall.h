@@ -0,0 +1,266 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Spectrogram / waterfall renderer for audio spectrum analyzers
+// Copyright (c) 2024 Samuel Gomes
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Types.h"
+#include "GraphicOps.h"
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+/// @brief Renders spectra as a scrolling waterfall directly into a 32bpp image.
+/// Every pushed spectrum becomes one line of pixels. Magnitudes are converted to decibels and mapped to colors through a
+/// 256-entry palette. The image is either scrolled with memmove() or, in ring mode, written at a moving position so that
+/// nothing is copied (the caller then draws the image in two parts starting at GetRingPosition()).
+class AudioAnalyzerWaterfall
+{
+public:
+    enum Orientation
+    {
+        ORIENTATION_HORIZONTAL = 0, // time runs left to right; low frequencies at the bottom
+        ORIENTATION_VERTICAL,       // time runs top to bottom; low frequencies on the left
+        ORIENTATION_COUNT
+    };
+
+    static constexpr auto PALETTE_SIZE = 256u;
+    static constexpr auto FLOOR_DB_DEFAULT = -90.0f;
+    static constexpr auto CEILING_DB_DEFAULT = 0.0f;
+
+    AudioAnalyzerWaterfall(int32_t imageHandle, int orientation, bool useRing)
+        : imageHandle(imageHandle), orientation(std::clamp(orientation, int(ORIENTATION_HORIZONTAL), int(ORIENTATION_COUNT) - 1)), useRing(useRing), ringPosition(0)
+    {
+        SetRange(FLOOR_DB_DEFAULT, CEILING_DB_DEFAULT);
+        SetGradient(0xFF000000u, 0xFF00FF00u, 0xFFFF0000u);
+    }
+
+    AudioAnalyzerWaterfall() = delete;
+    AudioAnalyzerWaterfall(const AudioAnalyzerWaterfall &) = delete;
+    AudioAnalyzerWaterfall &operator=(const AudioAnalyzerWaterfall &) = delete;
+
+    uint32_t GetRingPosition() const { return ringPosition; }
+
+    /// @brief Sets the decibel range that is spread across the palette. Values at or below floorDB get the first color.
+    void SetRange(float floorDB, float ceilingDB)
+    {
+        this->floorDB = floorDB;
+        scale = ceilingDB > floorDB ? float(PALETTE_SIZE - 1) / (ceilingDB - floorDB) : 0.0f;
+    }
+
+    /// @brief Builds the palette as a gradient from low to mid to high.
+    void SetGradient(uint32_t low, uint32_t mid, uint32_t high)
+    {
+        constexpr auto half = PALETTE_SIZE / 2;
+
+        for (auto i = 0u; i < half; i++)
+        {
+            palette[i] = Graphics_InterpolateColor(low, mid, float(i) / float(half));
+            palette[half + i] = Graphics_InterpolateColor(mid, high, float(i) / float(half - 1));
+        }
+    }
+
+    void SetPalette(const uint32_t *colors)
+    {
+        std::copy(colors, colors + PALETTE_SIZE, palette.begin());
+    }
+
+    /// @brief Fills the image with the first palette color and restarts the ring.
+    void Reset()
+    {
+        auto image = GetImage();
+        if (!image)
+            return;
+
+        std::fill(image->offset32, image->offset32 + size_t(image->width) * image->height, palette[0]);
+        ringPosition = 0;
+    }
+
+    /// @brief Adds one spectrum to the waterfall. Spectra are stretched or reduced (using max()) to fit the image. Pass the
+    /// output of AudioAnalyzerFFT_AggregateBands() instead of linear bins to get a log-frequency axis.
+    /// @param values The magnitudes (lowest frequency first).
+    /// @param count The number of values.
+    void Push(const float *values, uint32_t count)
+    {
+        auto image = GetImage();
+        if (!image or !count)
+            return;
+
+        const auto width = uint32_t(image->width);
+        const auto height = uint32_t(image->height);
+        const auto isVertical = orientation == ORIENTATION_VERTICAL;
+        const auto lineLength = isVertical ? width : height;
+        const auto depth = isVertical ? height : width;
+
+        if (!lineLength or !depth)
+            return;
+
+        // Map the values to pixel colors
+        line.resize(lineLength);
+        for (auto p = 0u; p < lineLength; p++)
+        {
+            auto first = uint32_t(uint64_t(p) * count / lineLength);
+            auto last = std::max(uint32_t(uint64_t(p + 1) * count / lineLength), first + 1);
+
+            auto value = 0.0f;
+            for (auto i = first; i < last; i++)
+                value = std::fmax(value, values[i]);
+
+            auto index = (20.0f * std::log10(std::fmax(value, 1e-12f)) - floorDB) * scale;
+            line[p] = palette[size_t(std::clamp(index, 0.0f, float(PALETTE_SIZE - 1)))];
+        }
+
+        // Pick the line to write and scroll the image if we are not using the ring
+        uint32_t position;
+        if (useRing)
+        {
+            position = ringPosition;
+            ringPosition = (ringPosition + 1) % depth;
+        }
+        else
+        {
+            position = depth - 1;
+
+            if (isVertical)
+            {
+                std::memmove(image->offset32, image->offset32 + width, size_t(width) * (height - 1) * sizeof(uint32_t));
+            }
+            else
+            {
+                for (auto y = 0u; y < height; y++)
+                {
+                    auto row = image->offset32 + size_t(y) * width;
+                    std::memmove(row, row + 1, size_t(width - 1) * sizeof(uint32_t));
+                }
+            }
+        }
+
+        if (isVertical)
+        {
+            std::copy(line.begin(), line.end(), image->offset32 + size_t(position) * width);
+        }
+        else
+        {
+            auto dst = image->offset32 + size_t(height - 1) * width + position;
+            for (auto p = 0u; p < lineLength; p++, dst -= width)
+                *dst = line[p];
+        }
+    }
+
+private:
+    /// @brief Resolves the image handle every time since QB64 may move the image table when images are created.
+    img_struct *GetImage() const
+    {
+        img_struct *image;
+        auto handle = imageHandle;
+
+        if (handle >= 0)
+        {
+            validatepage(handle);
+            image = &img[page[handle]];
+        }
+        else
+        {
+            handle = -handle;
+            if (handle >= nextimg)
+            {
+                error(QB_ERROR_INVALID_HANDLE);
+                return nullptr;
+            }
+            image = &img[handle];
+            if (!image->valid)
+            {
+                error(QB_ERROR_INVALID_HANDLE);
+                return nullptr;
+            }
+        }
+
+        if (image->text or image->bits_per_pixel != 32)
+        {
+            error(QB_ERROR_ILLEGAL_FUNCTION_CALL);
+            return nullptr;
+        }
+
+        return image;
+    }
+
+    int32_t imageHandle;
+    int orientation;
+    bool useRing;
+    uint32_t ringPosition;
+    float floorDB;
+    float scale;
+    std::array<uint32_t, PALETTE_SIZE> palette;
+    std::vector<uint32_t> line;
+};
+
+/// @brief Creates a waterfall renderer for a 32bpp image.
+/// @param imageHandle A valid 32bpp image handle. The image must outlive the renderer.
+/// @param orientation 0 = time runs horizontally, 1 = time runs vertically.
+/// @param useRing If true, lines are written at a moving position instead of scrolling the image.
+/// @return A pointer to the renderer object.
+uintptr_t AudioAnalyzerWaterfall_Create(int32_t imageHandle, int32_t orientation, qb_bool useRing)
+{
+    return reinterpret_cast<uintptr_t>(new AudioAnalyzerWaterfall(imageHandle, orientation, bool(useRing)));
+}
+
+/// @brief Deletes a renderer created using AudioAnalyzerWaterfall_Create(). The image is not freed.
+/// @param waterfall A valid pointer to a renderer.
+void AudioAnalyzerWaterfall_Destroy(uintptr_t waterfall)
+{
+    delete reinterpret_cast<AudioAnalyzerWaterfall *>(waterfall);
+}
+
+/// @brief Fills the image with the lowest palette color and restarts the ring.
+/// @param waterfall A valid pointer to a renderer.
+void AudioAnalyzerWaterfall_Reset(uintptr_t waterfall)
+{
+    reinterpret_cast<AudioAnalyzerWaterfall *>(waterfall)->Reset();
+}
+
+/// @brief Sets the decibel range mapped to the palette.
+/// @param waterfall A valid pointer to a renderer.
+/// @param floorDB The level that maps to the first palette color.
+/// @param ceilingDB The level that maps to the last palette color.
+void AudioAnalyzerWaterfall_SetRange(uintptr_t waterfall, float floorDB, float ceilingDB)
+{
+    reinterpret_cast<AudioAnalyzerWaterfall *>(waterfall)->SetRange(floorDB, ceilingDB);
+}
+
+/// @brief Builds the palette as a 3-color gradient.
+/// @param waterfall A valid pointer to a renderer.
+/// @param low The color for the lowest level.
+/// @param mid The color for the middle level.
+/// @param high The color for the highest level.
+void AudioAnalyzerWaterfall_SetGradient(uintptr_t waterfall, uint32_t low, uint32_t mid, uint32_t high)
+{
+    reinterpret_cast<AudioAnalyzerWaterfall *>(waterfall)->SetGradient(low, mid, high);
+}
+
+/// @brief Sets all 256 palette colors.
+/// @param waterfall A valid pointer to a renderer.
+/// @param paletteArray An array of 256 32-bit BGRA colors.
+void AudioAnalyzerWaterfall_SetPalette(uintptr_t waterfall, const uint32_t *paletteArray)
+{
+    reinterpret_cast<AudioAnalyzerWaterfall *>(waterfall)->SetPalette(paletteArray);
+}
+
+/// @brief Adds a spectrum to the waterfall.
+/// @param waterfall A valid pointer to a renderer.
+/// @param spectrumArray The magnitudes (lowest frequency first).
+/// @param count The number of magnitudes.
+void AudioAnalyzerWaterfall_Push(uintptr_t waterfall, const float *spectrumArray, uint32_t count)
+{
+    reinterpret_cast<AudioAnalyzerWaterfall *>(waterfall)->Push(spectrumArray, count);
+}
+
+/// @brief Returns the line that will be written next in ring mode. This is also the oldest line in the image.
+/// @param waterfall A valid pointer to a renderer.
+uint32_t AudioAnalyzerWaterfall_GetRingPosition(uintptr_t waterfall)
+{
+    return reinterpret_cast<AudioAnalyzerWaterfall *>(waterfall)->GetRingPosition();
+}
@@ -11,15 +11,21 @@
 
 #pragma once
 
+#include "Types.h"
+#include <array>
+#include <cmath>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <utility>
 
 static const auto AUDIOCONV_S8_TO_F32_MULTIPLER = 1.0f / 128.0f;
 static const auto AUDIOCONV_S16_TO_F32_MULTIPLER = 1.0f / 32768.0f;
 static const auto AUDIOCONV_S32_TO_F32_MULTIPLER = 1.0f / 2147483648.0f;
 static const auto AUDIOCONV_F32_TO_S8_MULTIPLIER = 127.0f;
 static const auto AUDIOCONV_F32_TO_S16_MULTIPLIER = 32767.0f;
-static const auto AUDIOCONV_F32_TO_S32_MULTIPLIER = 2147483647.0f;
+static const auto AUDIOCONV_F32_TO_S32_MULTIPLIER = 2147483647.0; // double: as a float this rounds up to 2^31, which overflows int32_t
+static constexpr uint32_t AUDIOCONV_ANALYZE_LANES = 32; // independent accumulators used by the analysis kernels
 
 /// @brief Converts unsigned 8-bit audio samples to signed 8-bit inplace.
 /// @param source The input unsigned 8-bit sample frame buffer.
@@ -389,3 +395,427 @@ uint64_t AudioConv_Resample(uintptr_t src, uintptr_t dst, int inSampleRate, int
 #define AudioConv_ResampleS16(_src_, _dst_, _src_sample_rate_, _dst_sample_rate_, _src_size_, _channels_) AudioConv_Resample<int16_t>(_src_, _dst_, _src_sample_rate_, _dst_sample_rate_, _src_size_, _channels_)
 #define AudioConv_ResampleS32(_src_, _dst_, _src_sample_rate_, _dst_sample_rate_, _src_size_, _channels_) AudioConv_Resample<int32_t>(_src_, _dst_, _src_sample_rate_, _dst_sample_rate_, _src_size_, _channels_)
 #define AudioConv_ResampleF32(_src_, _dst_, _src_sample_rate_, _dst_sample_rate_, _src_size_, _channels_) AudioConv_Resample<float>(_src_, _dst_, _src_sample_rate_, _dst_sample_rate_, _src_size_, _channels_)
+
+/// @brief Sample formats understood by AudioConv_Convert(). These values are shared with the QB64 side, so do not reorder them.
+enum AudioConv_Format : uint8_t
+{
+    AUDIOCONV_FORMAT_UNKNOWN = 0,
+    AUDIOCONV_FORMAT_U8,
+    AUDIOCONV_FORMAT_S16,
+    AUDIOCONV_FORMAT_S32,
+    AUDIOCONV_FORMAT_F32,
+    AUDIOCONV_FORMAT_S8,
+    AUDIOCONV_FORMAT_U16,
+    AUDIOCONV_FORMAT_ALAW,
+    AUDIOCONV_FORMAT_MULAW,
+    AUDIOCONV_FORMAT_COUNT // add new formats before this
+};
+
+/// @brief Per-format sample traits used to generate the conversion kernels. Each specialization describes the storage type
+/// and how a sample is widened to / narrowed from a left-justified 32-bit integer and a normalized float.
+/// Adding a new format only requires a new specialization and an enum value above.
+/// @tparam F The sample format.
+template <uint8_t F>
+struct __AudioConv_FormatTraits;
+
+template <>
+struct __AudioConv_FormatTraits<AUDIOCONV_FORMAT_U8>
+{
+    using Type = uint8_t;
+    static constexpr auto IsEncodable = true;
+    static inline int32_t ToS32(Type s) { return int32_t(uint32_t(s ^ 0x80u) << 24); }
+    static inline Type FromS32(int32_t s) { return Type((uint32_t(s) >> 24) ^ 0x80u); }
+    static inline float ToF32(Type s) { return float(int8_t(s ^ 0x80)) * AUDIOCONV_S8_TO_F32_MULTIPLER; }
+    static inline Type FromF32(float s) { return Type(int8_t(std::fmax(std::fmin(s, 1.0f), -1.0f) * AUDIOCONV_F32_TO_S8_MULTIPLIER)) ^ 0x80u; }
+};
+
+template <>
+struct __AudioConv_FormatTraits<AUDIOCONV_FORMAT_S8>
+{
+    using Type = int8_t;
+    static constexpr auto IsEncodable = true;
+    static inline int32_t ToS32(Type s) { return int32_t(uint32_t(uint8_t(s)) << 24); }
+    static inline Type FromS32(int32_t s) { return Type(s >> 24); }
+    static inline float ToF32(Type s) { return float(s) * AUDIOCONV_S8_TO_F32_MULTIPLER; }
+    static inline Type FromF32(float s) { return Type(std::fmax(std::fmin(s, 1.0f), -1.0f) * AUDIOCONV_F32_TO_S8_MULTIPLIER); }
+};
+
+template <>
+struct __AudioConv_FormatTraits<AUDIOCONV_FORMAT_U16>
+{
+    using Type = uint16_t;
+    static constexpr auto IsEncodable = true;
+    static inline int32_t ToS32(Type s) { return int32_t(uint32_t(s ^ 0x8000u) << 16); }
+    static inline Type FromS32(int32_t s) { return Type((uint32_t(s) >> 16) ^ 0x8000u); }
+    static inline float ToF32(Type s) { return float(int16_t(s ^ 0x8000)) * AUDIOCONV_S16_TO_F32_MULTIPLER; }
+    static inline Type FromF32(float s) { return Type(int16_t(std::fmax(std::fmin(s, 1.0f), -1.0f) * AUDIOCONV_F32_TO_S16_MULTIPLIER)) ^ 0x8000u; }
+};
+
+template <>
+struct __AudioConv_FormatTraits<AUDIOCONV_FORMAT_S16>
+{
+    using Type = int16_t;
+    static constexpr auto IsEncodable = true;
+    static inline int32_t ToS32(Type s) { return int32_t(uint32_t(uint16_t(s)) << 16); }
+    static inline Type FromS32(int32_t s) { return Type(s >> 16); }
+    static inline float ToF32(Type s) { return float(s) * AUDIOCONV_S16_TO_F32_MULTIPLER; }
+    static inline Type FromF32(float s) { return Type(std::fmax(std::fmin(s, 1.0f), -1.0f) * AUDIOCONV_F32_TO_S16_MULTIPLIER); }
+};
+
+template <>
+struct __AudioConv_FormatTraits<AUDIOCONV_FORMAT_S32>
+{
+    using Type = int32_t;
+    static constexpr auto IsEncodable = true;
+    static inline int32_t ToS32(Type s) { return s; }
+    static inline Type FromS32(int32_t s) { return s; }
+    static inline float ToF32(Type s) { return float(s) * AUDIOCONV_S32_TO_F32_MULTIPLER; }
+    static inline Type FromF32(float s) { return Type(double(std::fmax(std::fmin(s, 1.0f), -1.0f)) * AUDIOCONV_F32_TO_S32_MULTIPLIER); }
+};
+
+template <>
+struct __AudioConv_FormatTraits<AUDIOCONV_FORMAT_F32>
+{
+    using Type = float;
+    static constexpr auto IsEncodable = true;
+    static inline int32_t ToS32(Type s) { return __AudioConv_FormatTraits<AUDIOCONV_FORMAT_S32>::FromF32(s); }
+    static inline Type FromS32(int32_t s) { return float(s) * AUDIOCONV_S32_TO_F32_MULTIPLER; }
+    static inline float ToF32(Type s) { return s; }
+    static inline Type FromF32(float s) { return s; }
+};
+
+template <>
+struct __AudioConv_FormatTraits<AUDIOCONV_FORMAT_ALAW>
+{
+    using Type = int8_t;
+    static constexpr auto IsEncodable = false; // decode only
+    static inline int32_t ToS32(Type s) { return int32_t(uint32_t(uint16_t(__AudioConv_DecodeALawSample(s))) << 16); }
+    static inline Type FromS32(int32_t) { return 0; }
+    static inline float ToF32(Type s) { return float(__AudioConv_DecodeALawSample(s)) * AUDIOCONV_S16_TO_F32_MULTIPLER; }
+    static inline Type FromF32(float) { return 0; }
+};
+
+template <>
+struct __AudioConv_FormatTraits<AUDIOCONV_FORMAT_MULAW>
+{
+    using Type = int8_t;
+    static constexpr auto IsEncodable = false; // decode only
+    static inline int32_t ToS32(Type s) { return int32_t(uint32_t(uint16_t(__AudioConv_DecodeMuLawSample(s))) << 16); }
+    static inline Type FromS32(int32_t) { return 0; }
+    static inline float ToF32(Type s) { return float(__AudioConv_DecodeMuLawSample(s)) * AUDIOCONV_S16_TO_F32_MULTIPLER; }
+    static inline Type FromF32(float) { return 0; }
+};
+
+/// @brief Specialized conversion kernel for one source / destination format pair.
+/// src and dst may point to the same buffer. When the destination sample is wider than the source sample, the buffer is
+/// walked backwards so that an in-place conversion never overwrites source samples that have not been read yet.
+/// @tparam S The source format.
+/// @tparam D The destination format.
+/// @param src The source sample buffer.
+/// @param dst The destination sample buffer.
+/// @param samples The number of samples to convert, where samples = frames * channels.
+template <uint8_t S, uint8_t D>
+static void __AudioConv_ConvertKernel(const void *src, void *dst, uint32_t samples)
+{
+    using SrcTraits = __AudioConv_FormatTraits<S>;
+    using DstTraits = __AudioConv_FormatTraits<D>;
+    using SrcType = typename SrcTraits::Type;
+    using DstType = typename DstTraits::Type;
+
+    if constexpr (S == D)
+    {
+        if (src != dst)
+            memmove(dst, src, size_t(samples) * sizeof(SrcType));
+
+        return;
+    }
+
+    auto srcBuffer = reinterpret_cast<const SrcType *>(src);
+    auto dstBuffer = reinterpret_cast<DstType *>(dst);
+
+    auto convert = [](SrcType s) -> DstType
+    {
+        if constexpr (D == AUDIOCONV_FORMAT_F32)
+            return SrcTraits::ToF32(s);
+        else if constexpr (S == AUDIOCONV_FORMAT_F32)
+            return DstTraits::FromF32(s);
+        else
+            return DstTraits::FromS32(SrcTraits::ToS32(s));
+    };
+
+    if constexpr (sizeof(DstType) > sizeof(SrcType))
+    {
+        if (reinterpret_cast<const void *>(dstBuffer) == src)
+        {
+            for (auto i = size_t(samples); i-- > 0;)
+                dstBuffer[i] = convert(srcBuffer[i]);
+
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < samples; i++)
+        dstBuffer[i] = convert(srcBuffer[i]);
+}
+
+typedef void (*__AudioConv_ConvertKernelFunction)(const void *src, void *dst, uint32_t samples);
+
+/// @brief Returns the kernel for a format pair or nullptr if the pair is not supported.
+template <uint8_t S, uint8_t D>
+static constexpr __AudioConv_ConvertKernelFunction __AudioConv_GetConvertKernel()
+{
+    if constexpr (S == AUDIOCONV_FORMAT_UNKNOWN or D == AUDIOCONV_FORMAT_UNKNOWN)
+        return nullptr;
+    else if constexpr (S != D and !__AudioConv_FormatTraits<D>::IsEncodable)
+        return nullptr;
+    else
+        return &__AudioConv_ConvertKernel<S, D>;
+}
+
+/// @brief Builds the flattened [srcFormat * AUDIOCONV_FORMAT_COUNT + dstFormat] kernel table at compile time.
+template <size_t... I>
+static constexpr auto __AudioConv_MakeConvertKernelTable(std::index_sequence<I...>)
+{
+    return std::array<__AudioConv_ConvertKernelFunction, sizeof...(I)>{__AudioConv_GetConvertKernel<uint8_t(I / AUDIOCONV_FORMAT_COUNT), uint8_t(I % AUDIOCONV_FORMAT_COUNT)>()...};
+}
+
+static constexpr auto __AudioConv_ConvertKernelTable = __AudioConv_MakeConvertKernelTable(std::make_index_sequence<AUDIOCONV_FORMAT_COUNT * AUDIOCONV_FORMAT_COUNT>{});
+
+static inline __AudioConv_ConvertKernelFunction __AudioConv_LookupConvertKernel(uint8_t srcFormat, uint8_t dstFormat)
+{
+    if (srcFormat >= AUDIOCONV_FORMAT_COUNT or dstFormat >= AUDIOCONV_FORMAT_COUNT)
+        return nullptr;
+
+    return __AudioConv_ConvertKernelTable[srcFormat * AUDIOCONV_FORMAT_COUNT + dstFormat];
+}
+
+/// @brief Checks if AudioConv_Convert() can convert from one format to another.
+/// @param srcFormat The source format (AUDIOCONV_FORMAT_*).
+/// @param dstFormat The destination format (AUDIOCONV_FORMAT_*).
+/// @return QB_TRUE if the conversion is supported, QB_FALSE otherwise.
+qb_bool AudioConv_IsConversionSupported(uint8_t srcFormat, uint8_t dstFormat)
+{
+    return TO_QB_BOOL(__AudioConv_LookupConvertKernel(srcFormat, dstFormat) != nullptr);
+}
+
+/// @brief Converts audio samples from one format to another using a single table lookup. src and dst can be the same buffer.
+/// @param srcFormat The source format (AUDIOCONV_FORMAT_*).
+/// @param dstFormat The destination format (AUDIOCONV_FORMAT_*).
+/// @param src The input sample frame buffer.
+/// @param dst The output sample frame buffer. The buffer size must be at least samples * (destination sample size) bytes.
+/// @param samples The number of samples in the buffer, where samples = frames * channels.
+void AudioConv_Convert(uint8_t srcFormat, uint8_t dstFormat, uintptr_t src, uintptr_t dst, uint32_t samples)
+{
+    auto kernel = __AudioConv_LookupConvertKernel(srcFormat, dstFormat);
+
+    if (!kernel or !src or !dst or !samples)
+        return;
+
+    kernel(reinterpret_cast<const void *>(src), reinterpret_cast<void *>(dst), samples);
+}
+
+/// @brief Accumulates per-channel statistics for an interleaved floating point buffer.
+/// Every statistic is kept in several independent accumulators (lanes) and the buffer is walked in runs of one sample per
+/// lane, so the inner loop is plain element-wise arithmetic that the compiler can vectorize without reordering a
+/// reduction. With a fixed channel count there are AUDIOCONV_ANALYZE_LANES lanes and lane l belongs to channel l % C;
+/// otherwise there is one lane per channel. The lanes are folded into the per-channel results after every block. Sums
+/// are accumulated in float over short blocks and then folded into double to avoid precision loss on long buffers.
+/// @tparam C The number of channels (0 means the count is only known at runtime). This must divide AUDIOCONV_ANALYZE_LANES.
+template <uint32_t C>
+static void __AudioConv_AnalyzeF32(const float *buffer, uint32_t frames, uint32_t channels, float *peak, double *sum, double *sumSquares, uint32_t *clipCount)
+{
+    static constexpr uint32_t BLOCK_FRAMES = 4096;
+    static constexpr uint32_t MAX_LANES = 32; // the maximum channel count
+    static_assert(AUDIOCONV_ANALYZE_LANES <= MAX_LANES and (!C or AUDIOCONV_ANALYZE_LANES % C == 0), "bad lane count");
+
+    const auto ch = C ? C : channels;
+    const auto width = C ? AUDIOCONV_ANALYZE_LANES : ch;
+
+    float laneMax[MAX_LANES], laneSum[MAX_LANES], laneSumSquares[MAX_LANES];
+    uint32_t laneClip[MAX_LANES];
+
+    for (uint32_t f = 0; f < frames; f += BLOCK_FRAMES)
+    {
+        const auto count = size_t(std::min(BLOCK_FRAMES, frames - f)) * ch;
+        auto src = buffer + size_t(f) * ch;
+
+        for (uint32_t l = 0; l < width; l++)
+        {
+            laneMax[l] = laneSum[l] = laneSumSquares[l] = 0.0f;
+            laneClip[l] = 0;
+        }
+
+        size_t i = 0;
+
+        for (; i + width <= count; i += width)
+        {
+            for (uint32_t l = 0; l < width; l++)
+            {
+                auto s = src[i + l];
+                auto a = std::fabs(s);
+                laneMax[l] = a > laneMax[l] ? a : laneMax[l];
+                laneSum[l] += s;
+                laneSumSquares[l] += s * s;
+                laneClip[l] += a >= 1.0f;
+            }
+        }
+
+        // The last partial run starts on a lane boundary, so lane l still belongs to channel l % ch
+        for (uint32_t l = 0; i < count; i++, l++)
+        {
+            auto s = src[i];
+            auto a = std::fabs(s);
+            laneMax[l] = a > laneMax[l] ? a : laneMax[l];
+            laneSum[l] += s;
+            laneSumSquares[l] += s * s;
+            laneClip[l] += a >= 1.0f;
+        }
+
+        for (uint32_t l = 0; l < width; l++)
+        {
+            auto c = l % ch;
+            peak[c] = laneMax[l] > peak[c] ? laneMax[l] : peak[c];
+            sum[c] += laneSum[l];
+            sumSquares[c] += laneSumSquares[l];
+            clipCount[c] += laneClip[l];
+        }
+    }
+}
+
+/// @brief Analyzes an interleaved floating point sample frame buffer in a single pass and returns per-channel results.
+/// Any of the output pointers can be NULL if that result is not needed. Each output buffer must have room for channels elements.
+/// @param src The input floating point sample frame buffer.
+/// @param frames The number of sample frames in the buffer.
+/// @param channels The number of interleaved channels (1 - 32).
+/// @param peak Receives the absolute peak of each channel (float).
+/// @param rms Receives the RMS level of each channel (float).
+/// @param dcOffset Receives the DC offset (mean) of each channel (float).
+/// @param clipCount Receives the number of samples with an absolute value >= 1.0 in each channel (uint32_t).
+void AudioConv_AnalyzeF32(uintptr_t src, uint32_t frames, uint32_t channels, uintptr_t peak, uintptr_t rms, uintptr_t dcOffset, uintptr_t clipCount)
+{
+    if (!src or !frames or !channels or channels > 32)
+        return;
+
+    float peakValues[32] = {};
+    double sums[32] = {}, sumSquares[32] = {};
+    uint32_t clips[32] = {};
+
+    auto buffer = reinterpret_cast<const float *>(src);
+
+    switch (channels)
+    {
+    case 1:
+        __AudioConv_AnalyzeF32<1>(buffer, frames, channels, peakValues, sums, sumSquares, clips);
+        break;
+
+    case 2:
+        __AudioConv_AnalyzeF32<2>(buffer, frames, channels, peakValues, sums, sumSquares, clips);
+        break;
+
+    default:
+        __AudioConv_AnalyzeF32<0>(buffer, frames, channels, peakValues, sums, sumSquares, clips);
+    }
+
+    for (uint32_t c = 0; c < channels; c++)
+    {
+        if (peak)
+            reinterpret_cast<float *>(peak)[c] = peakValues[c];
+
+        if (rms)
+            reinterpret_cast<float *>(rms)[c] = float(std::sqrt(sumSquares[c] / double(frames)));
+
+        if (dcOffset)
+            reinterpret_cast<float *>(dcOffset)[c] = float(sums[c] / double(frames));
+
+        if (clipCount)
+            reinterpret_cast<uint32_t *>(clipCount)[c] = clips[c];
+    }
+}
+
+/// @brief Returns the absolute peak of all samples in a floating point buffer.
+/// @param src The input floating point sample buffer.
+/// @param samples The number of samples in the buffer, where samples = frames * channels.
+/// @return The absolute peak value.
+float AudioConv_GetPeakF32(uintptr_t src, uint32_t samples)
+{
+    if (!src or !samples)
+        return 0.0f;
+
+    auto buffer = reinterpret_cast<const float *>(src);
+
+    // Independent running maxima keep the loop free of a loop-carried dependency so that it vectorizes
+    float lanes[AUDIOCONV_ANALYZE_LANES] = {};
+    size_t i = 0;
+
+    for (; i + AUDIOCONV_ANALYZE_LANES <= samples; i += AUDIOCONV_ANALYZE_LANES)
+    {
+        for (uint32_t l = 0; l < AUDIOCONV_ANALYZE_LANES; l++)
+        {
+            auto a = std::fabs(buffer[i + l]);
+            lanes[l] = a > lanes[l] ? a : lanes[l];
+        }
+    }
+
+    auto peak = 0.0f;
+
+    for (; i < samples; i++)
+    {
+        auto a = std::fabs(buffer[i]);
+        peak = a > peak ? a : peak;
+    }
+
+    for (uint32_t l = 0; l < AUDIOCONV_ANALYZE_LANES; l++)
+        peak = lanes[l] > peak ? lanes[l] : peak;
+
+    return peak;
+}
+
+/// @brief Applies a gain to all samples in a floating point buffer inplace.
+/// @param src The floating point sample buffer.
+/// @param samples The number of samples in the buffer, where samples = frames * channels.
+/// @param gain The linear gain to apply.
+void AudioConv_ApplyGainF32(uintptr_t src, uint32_t samples, float gain)
+{
+    if (!src or !samples)
+        return;
+
+    auto buffer = reinterpret_cast<float *>(src);
+
+    for (size_t i = 0; i < samples; i++)
+        buffer[i] *= gain;
+}
+
+/// @brief Removes a per-channel DC offset and then scales an interleaved floating point buffer inplace so that its peak hits targetPeak.
+/// @param src The floating point sample frame buffer.
+/// @param frames The number of sample frames in the buffer.
+/// @param channels The number of interleaved channels (1 - 32).
+/// @param targetPeak The absolute peak level to normalize to (e.g. 1.0).
+/// @param removeDCOffset If this is true, the DC offset of each channel is removed before normalizing.
+/// @return The linear gain that was applied (1.0 if the buffer was silent).
+float AudioConv_NormalizeF32(uintptr_t src, uint32_t frames, uint32_t channels, float targetPeak, qb_bool removeDCOffset)
+{
+    if (!src or !frames or !channels or channels > 32)
+        return 1.0f;
+
+    auto buffer = reinterpret_cast<float *>(src);
+    auto samples = size_t(frames) * channels;
+
+    if (removeDCOffset)
+    {
+        float dcOffset[32];
+        AudioConv_AnalyzeF32(src, frames, channels, 0, 0, reinterpret_cast<uintptr_t>(dcOffset), 0);
+
+        for (size_t i = 0; i < samples; i += channels)
+            for (uint32_t c = 0; c < channels; c++)
+                buffer[i + c] -= dcOffset[c];
+    }
+
+    auto peak = AudioConv_GetPeakF32(src, samples);
+    if (peak <= 0.0f)
+        return 1.0f;
+
+    auto gain = targetPeak / peak;
+    AudioConv_ApplyGainF32(src, samples, gain);
+
+    return gain;
+}
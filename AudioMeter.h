@@ -0,0 +1,332 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Loudness and true-peak metering (ITU-R BS.1770 / EBU R128)
+// Copyright (c) 2024 Samuel Gomes
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Types.h"
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+/// @brief Incremental loudness meter.
+/// Audio is K-weighted (pre-filter shelf + RLB high-pass) and its mean square is accumulated in 100 ms segments. The
+/// momentary (400 ms) and short-term (3 s) loudness are sliding averages over those segments, and every 400 ms block
+/// (75% overlap) goes into a loudness histogram for the gated integrated loudness (like libebur128), so memory and query
+/// time do not grow with the duration. True-peak is measured on a 4x oversampled signal.
+/// Channels are processed in lockstep so that the compiler can keep the filter state for a stereo pair in one vector
+/// register.
+class AudioMeter
+{
+public:
+    static constexpr auto CHANNELS_MAX = 2u;
+    static constexpr auto LOUDNESS_SILENCE = -144.0;    // returned when there is nothing to measure
+    static constexpr auto SEGMENTS_PER_SECOND = 10u;    // 100 ms segments
+    static constexpr auto MOMENTARY_SEGMENTS = 4u;      // 400 ms
+    static constexpr auto SHORT_TERM_SEGMENTS = 30u;    // 3 s
+    static constexpr auto ABSOLUTE_GATE = -70.0;        // LUFS
+    static constexpr auto RELATIVE_GATE = -10.0;        // LU
+    static constexpr auto HISTOGRAM_MAX = 5.0;          // LUFS; louder blocks go into the top bin
+    static constexpr auto HISTOGRAM_BINS_PER_LU = 10u;  // 0.1 LU resolution for the relative gate
+    static constexpr auto HISTOGRAM_BINS = size_t((HISTOGRAM_MAX - ABSOLUTE_GATE) * HISTOGRAM_BINS_PER_LU);
+    static constexpr auto OVERSAMPLE_FACTOR = 4u;
+    static constexpr auto OVERSAMPLE_TAPS = 12u;        // taps per polyphase branch
+
+    /// @brief Creates a meter.
+    /// @param sampleRate The sample rate of the audio that will be measured.
+    /// @param channels The number of interleaved channels (1 or 2).
+    AudioMeter(uint32_t sampleRate, uint32_t channels)
+        : sampleRate(std::max(sampleRate, SEGMENTS_PER_SECOND)), channels(std::clamp(channels, 1u, CHANNELS_MAX))
+    {
+        segmentFrames = std::max((this->sampleRate + SEGMENTS_PER_SECOND / 2) / SEGMENTS_PER_SECOND, 1u);
+
+        // K-weighting coefficients for an arbitrary sample rate (BS.1770 specifies them at 48 kHz only)
+        auto k = std::tan(M_PI * 1681.974450955533 / this->sampleRate);
+        auto q = 0.7071752369554196;
+        auto vh = std::pow(10.0, 3.999843853973347 / 20.0);
+        auto vb = std::pow(vh, 0.4996667741545416);
+        auto a0 = 1.0 + k / q + k * k;
+        shelf = {(vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+
+        k = std::tan(M_PI * 38.13547087602444 / this->sampleRate);
+        q = 0.5003270373238773;
+        a0 = 1.0 + k / q + k * k;
+        highPass = {1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+
+        // Windowed-sinc interpolator split into OVERSAMPLE_FACTOR polyphase branches, each normalized to unity DC gain
+        constexpr auto taps = OVERSAMPLE_FACTOR * OVERSAMPLE_TAPS;
+        for (auto p = 0u; p < OVERSAMPLE_FACTOR; p++)
+        {
+            auto sum = 0.0;
+
+            for (auto t = 0u; t < OVERSAMPLE_TAPS; t++)
+            {
+                auto n = double(t * OVERSAMPLE_FACTOR + p);
+                auto x = (n - (taps - 1) / 2.0) / OVERSAMPLE_FACTOR;
+                auto sinc = x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+                auto window = 0.5 - 0.5 * std::cos(2.0 * M_PI * (n + 0.5) / taps);
+                // Taps are stored reversed so that the newest sample meets the last tap
+                interpolator[p][OVERSAMPLE_TAPS - 1 - t] = float(sinc * window);
+                sum += sinc * window;
+            }
+
+            for (auto &tap : interpolator[p])
+                tap = float(tap / sum);
+        }
+
+        Reset();
+    }
+
+    AudioMeter() = delete;
+    AudioMeter(const AudioMeter &) = delete;
+    AudioMeter &operator=(const AudioMeter &) = delete;
+
+    uint32_t GetChannels() const { return channels; }
+
+    void Reset()
+    {
+        for (auto &s : shelfState)
+            s.fill(0.0);
+        for (auto &s : highPassState)
+            s.fill(0.0);
+        for (auto &h : history)
+            h.fill(0.0f);
+
+        segmentEnergy.fill(0.0);
+        truePeak.fill(0.0f);
+        histogramEnergy.fill(0.0);
+        histogramCount.fill(0);
+        segmentSum = 0.0;
+        segmentPosition = 0;
+        segmentCount = 0;
+        historyPosition = 0;
+    }
+
+    /// @brief Measures a block of interleaved samples. Blocks of any size may be pushed.
+    void Process(const float *samples, uint32_t frames)
+    {
+        if (channels == 2)
+            ProcessFrames<2>(samples, frames);
+        else
+            ProcessFrames<1>(samples, frames);
+    }
+
+    double GetMomentaryLoudness() const { return ToLoudness(GetWindowEnergy(MOMENTARY_SEGMENTS)); }
+
+    double GetShortTermLoudness() const { return ToLoudness(GetWindowEnergy(SHORT_TERM_SEGMENTS)); }
+
+    /// @brief Returns the gated integrated loudness of everything measured since the last reset. The histogram only holds
+    /// blocks above the absolute gate. The relative gate keeps a bin if its center is above the threshold, so it is
+    /// resolved to 1 / HISTOGRAM_BINS_PER_LU LU.
+    double GetIntegratedLoudness() const
+    {
+        auto sum = 0.0;
+        uint64_t count = 0;
+        for (size_t i = 0; i < HISTOGRAM_BINS; i++)
+        {
+            sum += histogramEnergy[i];
+            count += histogramCount[i];
+        }
+
+        if (!count)
+            return LOUDNESS_SILENCE;
+
+        const auto relativeThreshold = ToLoudness(sum / count) + RELATIVE_GATE;
+        const auto first = size_t(std::max(std::ceil((relativeThreshold - ABSOLUTE_GATE) * HISTOGRAM_BINS_PER_LU - 0.5), 0.0));
+
+        sum = 0.0;
+        count = 0;
+        for (auto i = first; i < HISTOGRAM_BINS; i++)
+        {
+            sum += histogramEnergy[i];
+            count += histogramCount[i];
+        }
+
+        return count ? ToLoudness(sum / count) : LOUDNESS_SILENCE;
+    }
+
+    /// @brief Returns the highest linear true-peak seen on a channel since the last reset.
+    float GetTruePeak(uint32_t channel) const { return channel < channels ? truePeak[channel] : 0.0f; }
+
+private:
+    typedef std::array<double, 5> Biquad; // b0, b1, b2, a1, a2
+
+    static double ToLoudness(double energy) { return energy > 0.0 ? std::max(-0.691 + 10.0 * std::log10(energy), LOUDNESS_SILENCE) : LOUDNESS_SILENCE; }
+
+    /// @brief Mean energy over the last n completed segments. Segments before the first one count as silence.
+    double GetWindowEnergy(uint32_t n) const
+    {
+        auto sum = 0.0;
+        for (auto i = 0u; i < n; i++)
+            sum += segmentEnergy[(segmentCount + SHORT_TERM_SEGMENTS - 1 - i) % SHORT_TERM_SEGMENTS];
+
+        return sum / n;
+    }
+
+    template <uint32_t C>
+    void ProcessFrames(const float *samples, uint32_t frames)
+    {
+        while (frames)
+        {
+            auto count = std::min(frames, segmentFrames - segmentPosition);
+
+            // K-weighting (transposed direct form II) and mean square
+            for (auto i = 0u; i < count; i++)
+            {
+                for (auto c = 0u; c < C; c++)
+                {
+                    auto x = double(samples[i * C + c]);
+
+                    auto y = shelf[0] * x + shelfState[0][c];
+                    shelfState[0][c] = shelf[1] * x - shelf[3] * y + shelfState[1][c];
+                    shelfState[1][c] = shelf[2] * x - shelf[4] * y;
+
+                    auto z = highPass[0] * y + highPassState[0][c];
+                    highPassState[0][c] = highPass[1] * y - highPass[3] * z + highPassState[1][c];
+                    highPassState[1][c] = highPass[2] * y - highPass[4] * z;
+
+                    segmentSum += z * z;
+                }
+            }
+
+            // 4x oversampled true-peak. The history is written twice so that every branch is a contiguous dot product
+            for (auto i = 0u; i < count; i++)
+            {
+                for (auto c = 0u; c < C; c++)
+                {
+                    auto x = samples[i * C + c];
+                    auto &h = history[c];
+                    h[historyPosition] = h[historyPosition + OVERSAMPLE_TAPS] = x;
+
+                    auto peak = std::fabs(x);
+                    auto window = &h[historyPosition + 1];
+
+                    for (auto p = 0u; p < OVERSAMPLE_FACTOR; p++)
+                    {
+                        auto sum = 0.0f;
+                        for (auto t = 0u; t < OVERSAMPLE_TAPS; t++)
+                            sum += window[t] * interpolator[p][t];
+
+                        peak = std::fmax(peak, std::fabs(sum));
+                    }
+
+                    truePeak[c] = std::fmax(truePeak[c], peak);
+                }
+
+                historyPosition = (historyPosition + 1) % OVERSAMPLE_TAPS;
+            }
+
+            samples += count * C;
+            frames -= count;
+            segmentPosition += count;
+
+            if (segmentPosition >= segmentFrames)
+                CompleteSegment();
+        }
+    }
+
+    void CompleteSegment()
+    {
+        segmentEnergy[segmentCount % SHORT_TERM_SEGMENTS] = segmentSum / segmentFrames;
+        segmentCount++;
+        segmentSum = 0.0;
+        segmentPosition = 0;
+
+        // A new 400 ms gating block ends at every segment boundary once enough audio is in
+        if (segmentCount >= MOMENTARY_SEGMENTS)
+            AddBlock(GetWindowEnergy(MOMENTARY_SEGMENTS));
+    }
+
+    /// @brief Adds a gating block to the histogram. Blocks at or below the absolute gate are dropped.
+    void AddBlock(double energy)
+    {
+        auto loudness = ToLoudness(energy);
+        if (loudness <= ABSOLUTE_GATE)
+            return;
+
+        auto bin = std::min(size_t((loudness - ABSOLUTE_GATE) * HISTOGRAM_BINS_PER_LU), HISTOGRAM_BINS - 1);
+        histogramEnergy[bin] += energy;
+        histogramCount[bin]++;
+    }
+
+    uint32_t sampleRate;
+    uint32_t channels;
+    uint32_t segmentFrames;
+    Biquad shelf;
+    Biquad highPass;
+    std::array<std::array<double, CHANNELS_MAX>, 2> shelfState;
+    std::array<std::array<double, CHANNELS_MAX>, 2> highPassState;
+    std::array<std::array<float, OVERSAMPLE_TAPS>, OVERSAMPLE_FACTOR> interpolator;
+    std::array<std::array<float, OVERSAMPLE_TAPS * 2>, CHANNELS_MAX> history;
+    uint32_t historyPosition;
+    std::array<double, SHORT_TERM_SEGMENTS> segmentEnergy;
+    std::array<float, CHANNELS_MAX> truePeak;
+    std::array<double, HISTOGRAM_BINS> histogramEnergy; // summed energy of the 400 ms blocks in each 0.1 LU bin
+    std::array<uint64_t, HISTOGRAM_BINS> histogramCount;
+    double segmentSum;
+    uint32_t segmentPosition;
+    uint64_t segmentCount;
+};
+
+/// @brief Creates a loudness meter.
+/// @param sampleRate The sample rate of the audio that will be measured.
+/// @param channels The number of interleaved channels (1 or 2).
+/// @return A pointer to the meter object.
+uintptr_t AudioMeter_Create(uint32_t sampleRate, uint32_t channels)
+{
+    return reinterpret_cast<uintptr_t>(new AudioMeter(sampleRate, channels));
+}
+
+/// @brief Deletes a meter created using AudioMeter_Create().
+/// @param meter A valid pointer to a meter.
+void AudioMeter_Destroy(uintptr_t meter)
+{
+    delete reinterpret_cast<AudioMeter *>(meter);
+}
+
+/// @brief Clears all measurements and the filter state.
+/// @param meter A valid pointer to a meter.
+void AudioMeter_Reset(uintptr_t meter)
+{
+    reinterpret_cast<AudioMeter *>(meter)->Reset();
+}
+
+/// @brief Measures a block of interleaved FP32 samples.
+/// @param meter A valid pointer to a meter.
+/// @param src A pointer to the interleaved samples.
+/// @param frames The number of frames in src.
+void AudioMeter_ProcessF32(uintptr_t meter, uintptr_t src, uint32_t frames)
+{
+    reinterpret_cast<AudioMeter *>(meter)->Process(reinterpret_cast<const float *>(src), frames);
+}
+
+/// @brief Returns the momentary (400 ms) loudness in LUFS.
+/// @param meter A valid pointer to a meter.
+double AudioMeter_GetMomentaryLoudness(uintptr_t meter)
+{
+    return reinterpret_cast<AudioMeter *>(meter)->GetMomentaryLoudness();
+}
+
+/// @brief Returns the short-term (3 s) loudness in LUFS.
+/// @param meter A valid pointer to a meter.
+double AudioMeter_GetShortTermLoudness(uintptr_t meter)
+{
+    return reinterpret_cast<AudioMeter *>(meter)->GetShortTermLoudness();
+}
+
+/// @brief Returns the gated integrated loudness in LUFS.
+/// @param meter A valid pointer to a meter.
+double AudioMeter_GetIntegratedLoudness(uintptr_t meter)
+{
+    return reinterpret_cast<AudioMeter *>(meter)->GetIntegratedLoudness();
+}
+
+/// @brief Returns the highest linear true-peak of a channel.
+/// @param meter A valid pointer to a meter.
+/// @param channel The channel number (0 based).
+float AudioMeter_GetTruePeak(uintptr_t meter, uint32_t channel)
+{
+    return reinterpret_cast<AudioMeter *>(meter)->GetTruePeak(channel);
+}
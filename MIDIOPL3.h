@@ -0,0 +1,824 @@
+//----------------------------------------------------------------------------------------------------------------------
+// MIDI synthesizer for QB64-PE using Opal (OPL3 FM with OP2 / WOPL instrument banks)
+// Copyright (c) 2024 Samuel Gomes
+//
+// https://moddingwiki.shikadi.net/wiki/OP2_Bank_Format
+// https://github.com/Wohlstand/OPL3BankEditor/blob/master/Specifications/WOPL-and-OPLI-Specification.txt
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Types.h"
+#include "ResourceHandleManager.h"
+#include "OPL3.h"
+#include "MIDITimeline.h"
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+/// @brief Plays MIDI files (or live MIDI messages) through an OPL3 chip.
+/// Every note is mapped to one or two of the 18 two-operator channels using the instrument bank. Free channels are
+/// preferred (the one released the longest, ideally still programmed with the same instrument) and when all of them are
+/// busy the oldest note is stolen. MIDI events are queued on the chip at their exact frame (see
+/// OPL3::QueueWriteRegister()), so rendering is sample accurate and can run as fast as the CPU allows for offline use.
+class MIDIOPL3
+{
+public:
+    static constexpr uint32_t VOICES = 18;           // 2-op channels in OPL3 mode
+    static constexpr uint32_t INSTRUMENTS = 128;     // per bank (melodic programs / percussion notes)
+    static constexpr uint8_t PERCUSSION_CHANNEL = 9; // MIDI channel 10
+    static constexpr double RELEASE_TAIL = 2.0;      // seconds rendered at most after the end of the song
+    static constexpr double CHIP_RATE = 49716.0;     // native OPL3 sample rate
+    static constexpr float TL_STEP = 0.75f;          // dB per total level step
+
+    /// @brief Register values of one operator (0x20, 0x40, 0x60, 0x80 and 0xE0).
+    struct Operator
+    {
+        uint8_t characteristic;
+        uint8_t scaleLevel;
+        uint8_t attackDecay;
+        uint8_t sustainRelease;
+        uint8_t waveform;
+    };
+
+    /// @brief A 2-op voice of an instrument.
+    struct Patch
+    {
+        Operator modulator;
+        Operator carrier;
+        uint8_t feedbackConnection; // register 0xC0 without the output bits
+        int16_t noteOffset;         // semitones
+    };
+
+    struct Instrument
+    {
+        std::array<Patch, 2> patches;
+        uint8_t patchCount;     // 0 for a blank instrument; 2 for double voice instruments
+        bool isFixedNote;       // always plays fixedNote (used for percussion)
+        uint8_t fixedNote;
+        int8_t velocityOffset;
+        float secondDetune;     // semitones added to the second patch
+    };
+
+    MIDIOPL3(uint32_t sampleRate) : chip(sampleRate), depth(0), writeFrame(0), stamp(0), position(0), frame(0), passFrame(0), isLooping(false)
+    {
+        LoadDefaultBank();
+        Restart();
+    }
+
+    MIDIOPL3() = delete;
+    MIDIOPL3(const MIDIOPL3 &) = delete;
+    MIDIOPL3 &operator=(const MIDIOPL3 &) = delete;
+
+    /// @brief Loads an instrument bank in DMX OP2 (GENMIDI) or WOPL format. Only the first melodic and percussion banks
+    /// of a WOPL file are used. 4-op instruments are played as two layered 2-op voices.
+    /// @param data The file contents.
+    /// @param size The size of data in bytes.
+    /// @return True if the bank was recognized.
+    bool LoadBank(const uint8_t *data, size_t size)
+    {
+        auto isLoaded = (size >= 8 and !std::memcmp(data, "#OPL_II#", 8) and ParseOP2(data, size)) or
+                        (size >= 19 and !std::memcmp(data, "WOPL3-BANK", 11) and ParseWOPL(data, size));
+
+        if (!isLoaded)
+            return false;
+
+        // The voices point to the old instruments; notes start sounding again from the next note on
+        ResetChip();
+
+        return true;
+    }
+
+    /// @brief Loads a MIDI file (SMF, XMI or MUS) and rewinds to the start.
+    /// @return True if the file has anything to play.
+    bool LoadMIDI(const uint8_t *data, size_t size)
+    {
+        auto isLoaded = timeline.Load(data, size);
+        Restart();
+
+        return isLoaded;
+    }
+
+    void SetLooping(bool looping) { isLooping = looping; }
+
+    bool IsLooping() const { return isLooping; }
+
+    /// @brief Returns true while the song is playing (always true for a looping song). Notes that are still sounding at
+    /// the end of the song are given up to RELEASE_TAIL seconds to fade out.
+    bool IsPlaying() const
+    {
+        if (timeline.IsEmpty())
+            return false;
+
+        if (isLooping or position < timeline.GetSize())
+            return true;
+
+        auto endFrame = passFrame + TimeToFrame(timeline.GetDuration());
+
+        return frame < endFrame or (frame < endFrame + TimeToFrame(RELEASE_TAIL) and !chip.IsIdle());
+    }
+
+    double GetLength() const { return timeline.GetDuration(); }
+
+    double GetPosition() const { return double(frame - passFrame) / chip.GetSampleRate(); }
+
+    /// @brief Returns the number of chip channels that are playing a note (including sustained notes).
+    uint32_t GetActiveVoices() const
+    {
+        return uint32_t(std::count_if(voices.begin(), voices.end(), [](const Voice &voice)
+                                      { return voice.isActive; }));
+    }
+
+    /// @brief Renders stereo interleaved FP32 samples (overwriting buffer).
+    /// @return True while the song is playing.
+    bool Render(float *buffer, uint32_t frames)
+    {
+        const auto end = frame + frames;
+
+        while (!timeline.IsEmpty())
+        {
+            // Send everything that lands in this block
+            while (position < timeline.GetSize())
+            {
+                const auto &event = timeline.GetEvent(position);
+                auto eventFrame = passFrame + TimeToFrame(event.time);
+                if (eventFrame >= end)
+                    break;
+
+                writeFrame = uint32_t(std::max(eventFrame, frame) - frame);
+                ProcessMessage(event.kind, timeline.GetEventData(event), event.length);
+                position++;
+            }
+
+            // Wrap around if the song ends inside this block
+            auto durationFrames = TimeToFrame(timeline.GetDuration());
+            if (position < timeline.GetSize() or !isLooping or !durationFrames or passFrame + durationFrames >= end)
+                break;
+
+            passFrame += durationFrames;
+            writeFrame = uint32_t(std::max(passFrame, frame) - frame);
+            ReleaseAll();
+            position = 0;
+        }
+
+        chip.GenerateSamples(buffer, frames);
+        frame = end;
+        writeFrame = 0;
+
+        return IsPlaying();
+    }
+
+    /// @brief Moves the playback position. The chip is reset and the program and controller state at the new position
+    /// is rebuilt from the timeline, so notes start sounding again from the next note on.
+    /// @param seconds The new position in seconds (clamped to the length of the song).
+    void Seek(double seconds)
+    {
+        seconds = std::clamp(seconds, 0.0, timeline.GetDuration());
+
+        ResetChip();
+        position = timeline.FindPosition(seconds);
+        channels = timeline.GetChaseState(position);
+        frame = TimeToFrame(seconds);
+        passFrame = 0;
+    }
+
+    /// @brief Resets the chip and the channel state and rewinds to the start.
+    void Restart()
+    {
+        ResetChip();
+        MIDITimeline::ResetChaseState(channels);
+        position = 0;
+        frame = 0;
+        passFrame = 0;
+    }
+
+    /// @brief Plays a MIDI message right away (at the start of the next rendered block).
+    /// @param message The message bytes. SysEx resets are recognized; other SysEx messages are ignored.
+    /// @param length The number of bytes in message.
+    void SendMessage(const uint8_t *message, uint32_t length)
+    {
+        if (!length)
+            return;
+
+        auto kind = MIDITimeline::EventKind::Message;
+        if (message[0] == 0xF0u and message[length - 1] == MIDITimeline::SysExEnd and MIDITimeline::IsSysExReset(message))
+            kind = MIDITimeline::EventKind::Reset;
+
+        ProcessMessage(kind, message, length);
+    }
+
+private:
+    /// @brief The state of one chip channel.
+    struct Voice
+    {
+        const Instrument *instrument;
+        uint8_t patch;        // index into instrument->patches
+        uint8_t channel;      // MIDI channel
+        uint8_t note;         // MIDI note that started the voice
+        uint8_t key;          // note that sets the pitch (differs for fixed note instruments)
+        uint8_t velocity;
+        bool isActive;        // keyed on or held by the sustain pedal
+        bool isSustained;     // note off was received while the sustain pedal was down
+        uint8_t blockNumber;  // register 0xB0 without the key on bit
+        uint64_t stamp;       // when the voice was last keyed on or released
+    };
+
+    uint64_t TimeToFrame(double seconds) const { return uint64_t(seconds * chip.GetSampleRate() + 0.5); }
+
+    static uint16_t ChannelRegister(uint32_t voice) { return uint16_t((voice / 9) * 0x100 + voice % 9); }
+
+    static uint16_t ModulatorRegister(uint32_t voice)
+    {
+        static constexpr uint8_t offsets[] = {0, 1, 2, 8, 9, 10, 16, 17, 18};
+        return uint16_t((voice / 9) * 0x100 + offsets[voice % 9]);
+    }
+
+    static uint16_t CarrierRegister(uint32_t voice) { return ModulatorRegister(voice) + 3; }
+
+    /// @brief Queues a register write at the frame of the event being processed.
+    void Write(uint16_t address, uint8_t data) { chip.QueueWriteRegister(writeFrame, address, data); }
+
+    /// @brief Resets the chip, puts it in OPL3 mode and frees every voice.
+    void ResetChip()
+    {
+        chip.Reset();
+        writeFrame = 0;
+
+        Write(0x105, 0x01); // OPL3 mode
+        Write(0x104, 0x00); // 2-op channels only
+        Write(0x001, 0x20); // waveform select
+        Write(0x0BD, depth);
+
+        for (uint32_t v = 0; v < VOICES; v++)
+        {
+            voices[v] = Voice{};
+            Write(0xB0 + ChannelRegister(v), 0);
+        }
+    }
+
+    /// @brief Handles a MIDI message at writeFrame.
+    void ProcessMessage(MIDITimeline::EventKind kind, const uint8_t *message, uint32_t length)
+    {
+        MIDITimeline::UpdateChaseState(channels, kind, message, length);
+
+        if (kind != MIDITimeline::EventKind::Message)
+        {
+            ReleaseAll();
+            return;
+        }
+
+        if (message[0] >= 0xF0u or length < 2)
+            return;
+
+        auto channel = uint8_t(message[0] & 0xF);
+        auto data1 = uint8_t(message[1] & 127);
+        auto data2 = uint8_t(length >= 3 ? message[2] & 127 : 0);
+
+        switch (message[0] >> 4)
+        {
+        case 0b1000: // note off
+            NoteOff(channel, data1);
+            break;
+
+        case 0b1001: // note on
+            if (length >= 3 and data2)
+                NoteOn(channel, data1, data2);
+            else
+                NoteOff(channel, data1);
+            break;
+
+        case 0b1011: // control change
+            if (length >= 3)
+                ControlChange(channel, data1, data2);
+            break;
+
+        case 0b1110: // pitch bend
+            UpdateVoices(channel, [this](uint32_t v)
+                         { UpdateFrequency(v); });
+            break;
+        }
+    }
+
+    void NoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
+    {
+        const auto &instrument = channel == PERCUSSION_CHANNEL ? percussion[note] : melodic[channels[channel].program];
+        if (!instrument.patchCount)
+            return;
+
+        auto key = instrument.isFixedNote ? instrument.fixedNote : note;
+        velocity = uint8_t(std::clamp(velocity + instrument.velocityOffset, 1, 127));
+
+        for (uint8_t p = 0; p < instrument.patchCount; p++)
+        {
+            auto v = AllocateVoice(&instrument, p);
+            auto &voice = voices[v];
+            auto isProgrammed = voice.instrument == &instrument and voice.patch == p;
+
+            voice.instrument = &instrument;
+            voice.patch = p;
+            voice.channel = channel;
+            voice.note = note;
+            voice.key = key;
+            voice.velocity = velocity;
+            voice.isActive = true;
+            voice.isSustained = false;
+            voice.stamp = ++stamp;
+
+            if (!isProgrammed)
+                ProgramVoice(v);
+            UpdateOutput(v);
+            UpdateLevel(v);
+            UpdateFrequency(v);
+        }
+    }
+
+    void NoteOff(uint8_t channel, uint8_t note)
+    {
+        auto isSustainDown = channels[channel].GetControl(64, 0) >= 64;
+
+        for (uint32_t v = 0; v < VOICES; v++)
+        {
+            auto &voice = voices[v];
+            if (voice.isActive and !voice.isSustained and voice.channel == channel and voice.note == note)
+            {
+                if (isSustainDown)
+                    voice.isSustained = true;
+                else
+                    ReleaseVoice(v);
+            }
+        }
+    }
+
+    void ControlChange(uint8_t channel, uint8_t id, uint8_t value)
+    {
+        switch (id)
+        {
+        case 6:  // data entry (the pitch bend range may have changed)
+        case 38:
+            UpdateVoices(channel, [this](uint32_t v)
+                         { UpdateFrequency(v); });
+            break;
+
+        case 7:  // volume
+        case 11: // expression
+            UpdateVoices(channel, [this](uint32_t v)
+                         { UpdateLevel(v); });
+            break;
+
+        case 10: // pan
+            UpdateVoices(channel, [this](uint32_t v)
+                         { UpdateOutput(v); });
+            break;
+
+        case 64: // sustain pedal
+            if (value < 64)
+                ReleaseSustained(channel);
+            break;
+
+        case 120: // all sound off
+            UpdateVoices(channel, [this](uint32_t v)
+                         { SilenceVoice(v); });
+            break;
+
+        case 121: // reset all controllers
+            ReleaseSustained(channel);
+            UpdateVoices(channel, [this](uint32_t v)
+                         { UpdateLevel(v); UpdateFrequency(v); });
+            break;
+
+        case 123: // all notes off (and the mode changes that imply it)
+        case 124:
+        case 125:
+        case 126:
+        case 127:
+            for (uint32_t v = 0; v < VOICES; v++)
+            {
+                if (voices[v].isActive and voices[v].channel == channel)
+                    NoteOff(channel, voices[v].note);
+            }
+            break;
+        }
+    }
+
+    /// @brief Calls function for every active voice of a MIDI channel.
+    template <typename Function>
+    void UpdateVoices(uint8_t channel, Function function)
+    {
+        for (uint32_t v = 0; v < VOICES; v++)
+        {
+            if (voices[v].isActive and voices[v].channel == channel)
+                function(v);
+        }
+    }
+
+    /// @brief Picks a chip channel for a new note.
+    /// A free channel already programmed with the same patch is preferred, then the free channel that was released the
+    /// longest. If every channel is busy, the oldest sustained note is stolen, and failing that the oldest note.
+    uint32_t AllocateVoice(const Instrument *instrument, uint8_t patch)
+    {
+        uint32_t best = VOICES;
+        auto bestScore = UINT64_MAX;
+
+        for (uint32_t v = 0; v < VOICES; v++)
+        {
+            const auto &voice = voices[v];
+
+            // Lower is better: free < sustained < playing, then by age
+            auto group = !voice.isActive ? (voice.instrument == instrument and voice.patch == patch ? 0 : 1) : (voice.isSustained ? 2 : 3);
+            auto score = (uint64_t(group) << 60) | voice.stamp;
+
+            if (score < bestScore)
+            {
+                bestScore = score;
+                best = v;
+            }
+        }
+
+        // A stolen voice has to be keyed off so that the envelope restarts
+        if (voices[best].isActive)
+            Write(0xB0 + ChannelRegister(best), voices[best].blockNumber);
+
+        return best;
+    }
+
+    void ReleaseVoice(uint32_t v)
+    {
+        auto &voice = voices[v];
+        voice.isActive = false;
+        voice.isSustained = false;
+        voice.stamp = ++stamp;
+        Write(0xB0 + ChannelRegister(v), voice.blockNumber);
+    }
+
+    /// @brief Releases a voice with the fastest release rate so that it stops right away.
+    void SilenceVoice(uint32_t v)
+    {
+        const auto &patch = voices[v].instrument->patches[voices[v].patch];
+        Write(0x80 + ModulatorRegister(v), patch.modulator.sustainRelease | 0x0F);
+        Write(0x80 + CarrierRegister(v), patch.carrier.sustainRelease | 0x0F);
+        ReleaseVoice(v);
+        voices[v].instrument = nullptr; // the release rate has to be programmed again
+    }
+
+    void ReleaseSustained(uint8_t channel)
+    {
+        for (uint32_t v = 0; v < VOICES; v++)
+        {
+            if (voices[v].isActive and voices[v].isSustained and voices[v].channel == channel)
+                ReleaseVoice(v);
+        }
+    }
+
+    void ReleaseAll()
+    {
+        for (uint32_t v = 0; v < VOICES; v++)
+        {
+            if (voices[v].isActive)
+                ReleaseVoice(v);
+        }
+    }
+
+    /// @brief Writes the operator registers of the voice's patch.
+    void ProgramVoice(uint32_t v)
+    {
+        const auto &patch = voices[v].instrument->patches[voices[v].patch];
+
+        WriteOperator(ModulatorRegister(v), patch.modulator);
+        WriteOperator(CarrierRegister(v), patch.carrier);
+    }
+
+    void WriteOperator(uint16_t address, const Operator &op)
+    {
+        Write(0x20 + address, op.characteristic);
+        Write(0x40 + address, op.scaleLevel);
+        Write(0x60 + address, op.attackDecay);
+        Write(0x80 + address, op.sustainRelease);
+        Write(0xE0 + address, op.waveform & 7);
+    }
+
+    /// @brief Writes the feedback / connection register with the output bits for the channel's pan position.
+    void UpdateOutput(uint32_t v)
+    {
+        const auto &patch = voices[v].instrument->patches[voices[v].patch];
+        auto pan = channels[voices[v].channel].GetControl(10, 64);
+        uint8_t output = pan < 48 ? 0x10 : pan > 80 ? 0x20 : 0x30; // left, right or both
+
+        Write(0xC0 + ChannelRegister(v), output | (patch.feedbackConnection & 0x0F));
+    }
+
+    /// @brief Attenuates the output operators for the note velocity and the channel volume and expression.
+    void UpdateLevel(uint32_t v)
+    {
+        const auto &voice = voices[v];
+        const auto &patch = voice.instrument->patches[voice.patch];
+        const auto &channel = channels[voice.channel];
+
+        // GM recommends 40 log10 curves for velocity, volume and expression
+        auto gain = voice.velocity / 127.0f * channel.GetControl(7, 100) / 127.0f * channel.GetControl(11, 127) / 127.0f;
+        auto attenuation = gain > 0.0f ? -40.0f * std::log10(gain) / TL_STEP : 63.0f;
+
+        auto scale = [attenuation](uint8_t scaleLevel)
+        {
+            return uint8_t((scaleLevel & 0xC0) | uint8_t(std::min((scaleLevel & 0x3F) + attenuation + 0.5f, 63.0f)));
+        };
+
+        Write(0x40 + CarrierRegister(v), scale(patch.carrier.scaleLevel));
+
+        // In additive mode the modulator is heard directly
+        if (patch.feedbackConnection & 1)
+            Write(0x40 + ModulatorRegister(v), scale(patch.modulator.scaleLevel));
+    }
+
+    /// @brief Sets the pitch from the note, the patch offset and the channel pitch bend. Also keys the voice on.
+    void UpdateFrequency(uint32_t v)
+    {
+        auto &voice = voices[v];
+        const auto &patch = voice.instrument->patches[voice.patch];
+
+        auto note = voice.key + patch.noteOffset + (voice.patch ? voice.instrument->secondDetune : 0.0f) + channels[voice.channel].GetPitchBend();
+        auto frequency = 440.0 * std::exp2((note - 69.0) / 12.0);
+
+        // Use the lowest block (finest resolution) that can represent the frequency
+        uint32_t block = 0;
+        auto number = uint32_t(frequency * (1 << 20) / CHIP_RATE);
+        while (number >= 1024 and block < 7)
+        {
+            block++;
+            number = uint32_t(frequency * (1 << (20 - block)) / CHIP_RATE);
+        }
+        number = std::min(number, 1023u);
+
+        voice.blockNumber = uint8_t((block << 2) | (number >> 8));
+        Write(0xA0 + ChannelRegister(v), uint8_t(number));
+        Write(0xB0 + ChannelRegister(v), 0x20 | voice.blockNumber);
+    }
+
+    static uint16_t ReadU16(const uint8_t *p) { return uint16_t(p[0] | (p[1] << 8)); }
+
+    static uint16_t ReadU16BE(const uint8_t *p) { return uint16_t((p[0] << 8) | p[1]); }
+
+    static Operator ReadOperator(const uint8_t *p) { return Operator{p[0], p[1], p[2], p[3], p[4]}; }
+
+    /// @brief Parses a DMX GENMIDI bank: 128 melodic instruments followed by 47 percussion instruments (notes 35 - 81).
+    bool ParseOP2(const uint8_t *data, size_t size)
+    {
+        static constexpr size_t INSTRUMENT_SIZE = 36;
+        static constexpr size_t INSTRUMENT_COUNT = 175;
+        static constexpr uint8_t FIRST_PERCUSSION_NOTE = 35;
+
+        if (size < 8 + INSTRUMENT_COUNT * INSTRUMENT_SIZE)
+            return false;
+
+        melodic.fill(Instrument{});
+        percussion.fill(Instrument{});
+        depth = 0;
+
+        for (size_t i = 0; i < INSTRUMENT_COUNT; i++)
+        {
+            auto p = data + 8 + i * INSTRUMENT_SIZE;
+            auto &instrument = i < INSTRUMENTS ? melodic[i] : percussion[i - INSTRUMENTS + FIRST_PERCUSSION_NOTE];
+            auto flags = ReadU16(p);
+
+            instrument.patchCount = flags & 4 ? 2 : 1;
+            instrument.isFixedNote = flags & 1;
+            instrument.fixedNote = p[3] & 127;
+            instrument.velocityOffset = 0;
+            instrument.secondDetune = (p[2] / 2 - 64) / 32.0f; // 1/32 semitones
+
+            for (auto v = 0; v < 2; v++)
+            {
+                // Operators are stored as characteristic, attack, sustain, waveform, scale, level
+                auto q = p + 4 + v * 16;
+                auto &patch = instrument.patches[v];
+                patch.modulator = Operator{q[0], uint8_t(q[4] | q[5]), q[1], q[2], q[3]};
+                patch.feedbackConnection = q[6];
+                patch.carrier = Operator{q[7], uint8_t(q[11] | q[12]), q[8], q[9], q[10]};
+                patch.noteOffset = int16_t(ReadU16(q + 14));
+            }
+        }
+
+        return true;
+    }
+
+    /// @brief Parses the first melodic and percussion banks of a WOPL bank.
+    bool ParseWOPL(const uint8_t *data, size_t size)
+    {
+        auto version = ReadU16(data + 11);
+        size_t melodicBanks = ReadU16BE(data + 13);
+        size_t percussionBanks = ReadU16BE(data + 15);
+        auto flags = data[17];
+
+        size_t offset = 19;
+        if (version >= 2)
+            offset += (melodicBanks + percussionBanks) * 34; // bank names and MIDI bank numbers
+
+        size_t instrumentSize = version >= 3 ? 66 : 62; // version 3 adds key on / off delays
+        if (!melodicBanks or offset + (melodicBanks + percussionBanks) * INSTRUMENTS * instrumentSize > size)
+            return false;
+
+        for (size_t i = 0; i < INSTRUMENTS; i++)
+        {
+            melodic[i] = ReadWOPLInstrument(data + offset + i * instrumentSize);
+            percussion[i] = percussionBanks ? ReadWOPLInstrument(data + offset + (melodicBanks * INSTRUMENTS + i) * instrumentSize) : Instrument{};
+        }
+
+        depth = uint8_t(((flags & 1) << 7) | ((flags & 2) << 5)); // deep tremolo and deep vibrato
+
+        return true;
+    }
+
+    static Instrument ReadWOPLInstrument(const uint8_t *p)
+    {
+        enum : uint8_t
+        {
+            FLAG_4OP = 1,
+            FLAG_PSEUDO_4OP = 2,
+            FLAG_BLANK = 4
+        };
+
+        Instrument instrument{};
+        auto flags = p[39];
+
+        if (flags & FLAG_BLANK)
+            return instrument;
+
+        // After the 32 byte name: note offsets, velocity offset, second voice detune, percussion key, flags, the two
+        // feedback / connection bytes and the operators ordered as carrier 1, modulator 1, carrier 2, modulator 2
+        instrument.patchCount = flags & (FLAG_4OP | FLAG_PSEUDO_4OP) ? 2 : 1;
+        instrument.isFixedNote = p[38] != 0;
+        instrument.fixedNote = p[38] & 127;
+        instrument.velocityOffset = int8_t(p[36]);
+        instrument.secondDetune = int8_t(p[37]) * 0.015625f;
+
+        for (auto v = 0; v < 2; v++)
+        {
+            auto &patch = instrument.patches[v];
+            patch.noteOffset = int16_t(ReadU16BE(p + 32 + v * 2));
+            patch.feedbackConnection = p[40 + v];
+            patch.carrier = ReadOperator(p + 42 + v * 10);
+            patch.modulator = ReadOperator(p + 47 + v * 10);
+        }
+
+        return instrument;
+    }
+
+    /// @brief Sets up a simple FM piano for every program and a noisy hit for every percussion note, so that something
+    /// is heard before a real bank is loaded.
+    void LoadDefaultBank()
+    {
+        Instrument piano{};
+        piano.patchCount = 1;
+        piano.patches[0].modulator = Operator{0x21, 0x1A, 0xF3, 0x35, 0};
+        piano.patches[0].carrier = Operator{0x01, 0x00, 0xF2, 0x16, 0};
+        piano.patches[0].feedbackConnection = 0x0A;
+
+        Instrument hit{};
+        hit.patchCount = 1;
+        hit.patches[0].modulator = Operator{0x0F, 0x00, 0xF8, 0x0F, 0};
+        hit.patches[0].carrier = Operator{0x00, 0x00, 0xF6, 0x0F, 0};
+        hit.patches[0].feedbackConnection = 0x0E;
+
+        melodic.fill(piano);
+        percussion.fill(hit);
+        depth = 0;
+    }
+
+    OPL3 chip;
+    std::array<Instrument, INSTRUMENTS> melodic;
+    std::array<Instrument, INSTRUMENTS> percussion; // by note
+    uint8_t depth;                                  // register 0xBD (tremolo and vibrato depth)
+    std::array<Voice, VOICES> voices;
+    MIDITimeline::ChaseState channels;
+    uint32_t writeFrame; // frame offset of the register writes of the event being processed
+    uint64_t stamp;      // voice age counter
+    MIDITimeline timeline;
+    size_t position;   // next event to play
+    uint64_t frame;    // output frames rendered since the last seek
+    uint64_t passFrame; // frame at which the current pass through the song started
+    bool isLooping;
+};
+
+static ResourceHandleManager<MIDIOPL3> g_MIDIOPL3Manager;
+
+/// @brief Creates an OPL3 MIDI synthesizer. A simple built-in bank is used until MIDIOPL3_LoadBank() is called.
+/// @param sampleRate The sample rate to render at.
+/// @return A handle to the synthesizer, or InvalidHandle if sampleRate is 0.
+inline ResourceHandleManager<MIDIOPL3>::Handle MIDIOPL3_Create(uint32_t sampleRate)
+{
+    if (!sampleRate)
+        return ResourceHandleManager<MIDIOPL3>::InvalidHandle;
+
+    return g_MIDIOPL3Manager.CreateHandle(std::make_unique<MIDIOPL3>(sampleRate));
+}
+
+/// @brief Deletes a synthesizer created using MIDIOPL3_Create().
+/// @param handle A synthesizer handle.
+inline void MIDIOPL3_Delete(ResourceHandleManager<MIDIOPL3>::Handle handle)
+{
+    g_MIDIOPL3Manager.ReleaseHandle(handle);
+}
+
+/// @brief Loads a GM instrument bank (DMX OP2 / GENMIDI or WOPL) from memory.
+/// @param handle A synthesizer handle.
+/// @param buffer The file contents.
+/// @param size The size of buffer in bytes.
+/// @return True if the bank was recognized.
+inline qb_bool MIDIOPL3_LoadBank(ResourceHandleManager<MIDIOPL3>::Handle handle, const char *buffer, uint32_t size)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    return synth and buffer ? TO_QB_BOOL(synth->LoadBank(reinterpret_cast<const uint8_t *>(buffer), size)) : QB_FALSE;
+}
+
+/// @brief Loads a MIDI file (SMF, XMI or MUS) from memory.
+/// @param handle A synthesizer handle.
+/// @param buffer The file contents.
+/// @param size The size of buffer in bytes.
+/// @return True if the file was recognized and has anything to play.
+inline qb_bool MIDIOPL3_LoadMIDI(ResourceHandleManager<MIDIOPL3>::Handle handle, const char *buffer, uint32_t size)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    return synth and buffer ? TO_QB_BOOL(synth->LoadMIDI(reinterpret_cast<const uint8_t *>(buffer), size)) : QB_FALSE;
+}
+
+/// @brief Renders the next block of the song. This can be called as fast as needed to render offline.
+/// @param handle A synthesizer handle.
+/// @param buffer A stereo interleaved FP32 buffer that is overwritten.
+/// @param frames The number of frames to render.
+/// @return True while the song is playing.
+inline qb_bool MIDIOPL3_Render(ResourceHandleManager<MIDIOPL3>::Handle handle, float *buffer, uint32_t frames)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    return synth ? TO_QB_BOOL(synth->Render(buffer, frames)) : QB_FALSE;
+}
+
+/// @brief Checks if the song is still playing.
+/// @param handle A synthesizer handle.
+inline qb_bool MIDIOPL3_IsPlaying(ResourceHandleManager<MIDIOPL3>::Handle handle)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    return synth ? TO_QB_BOOL(synth->IsPlaying()) : QB_FALSE;
+}
+
+/// @brief Enables or disables looping.
+/// @param handle A synthesizer handle.
+/// @param looping True to loop.
+inline void MIDIOPL3_SetLooping(ResourceHandleManager<MIDIOPL3>::Handle handle, qb_bool looping)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    if (synth)
+        synth->SetLooping(bool(looping));
+}
+
+/// @brief Returns the length of the song in seconds.
+/// @param handle A synthesizer handle.
+inline double MIDIOPL3_GetLength(ResourceHandleManager<MIDIOPL3>::Handle handle)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    return synth ? synth->GetLength() : 0.0;
+}
+
+/// @brief Returns the playback position in seconds.
+/// @param handle A synthesizer handle.
+inline double MIDIOPL3_GetPosition(ResourceHandleManager<MIDIOPL3>::Handle handle)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    return synth ? synth->GetPosition() : 0.0;
+}
+
+/// @brief Seeks to a position in the song.
+/// @param handle A synthesizer handle.
+/// @param seconds The new position in seconds.
+inline void MIDIOPL3_Seek(ResourceHandleManager<MIDIOPL3>::Handle handle, double seconds)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    if (synth)
+        synth->Seek(seconds);
+}
+
+/// @brief Plays a MIDI channel message right away. This works with or without a song loaded.
+/// @param handle A synthesizer handle.
+/// @param status The status byte.
+/// @param data1 The first data byte.
+/// @param data2 The second data byte (ignored by 2-byte messages).
+inline void MIDIOPL3_SendMessage(ResourceHandleManager<MIDIOPL3>::Handle handle, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    if (synth)
+    {
+        uint8_t message[] = {status, data1, data2};
+        auto type = status >> 4;
+        synth->SendMessage(message, type == 0b1100 or type == 0b1101 ? 2 : 3);
+    }
+}
+
+/// @brief Returns the number of OPL3 channels that are playing a note.
+/// @param handle A synthesizer handle.
+inline uint32_t MIDIOPL3_GetActiveVoices(ResourceHandleManager<MIDIOPL3>::Handle handle)
+{
+    auto synth = g_MIDIOPL3Manager.GetResource(handle);
+    return synth ? synth->GetActiveVoices() : 0;
+}
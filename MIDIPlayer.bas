@@ -97,4 +97,68 @@ SUB MIDI_PlayFromFile (fileName AS STRING)
     MIDI_PlayFromMemory File_Load(fileName)
 END SUB
 
+
+FUNCTION MIDI_QueueFromMemory%% (buffer AS STRING)
+    MIDI_QueueFromMemory = __MIDI_QueueFromMemory(buffer, LEN(buffer))
+END FUNCTION
+
+
+SUB MIDI_QueueFromMemory (buffer AS STRING)
+    DIM sink AS LONG: sink = __MIDI_QueueFromMemory(buffer, LEN(buffer))
+END SUB
+
+
+FUNCTION MIDI_QueueFromFile%% (fileName AS STRING)
+    MIDI_QueueFromFile = MIDI_QueueFromMemory(File_Load(fileName))
+END FUNCTION
+
+
+SUB MIDI_QueueFromFile (fileName AS STRING)
+    MIDI_QueueFromMemory File_Load(fileName)
+END SUB
+
+
+FUNCTION MIDIPlayer_PlayFromMemory%% (handle AS LONG, buffer AS STRING)
+    MIDIPlayer_PlayFromMemory = __MIDIPlayer_PlayFromMemory(handle, buffer, LEN(buffer))
+END FUNCTION
+
+
+SUB MIDIPlayer_PlayFromMemory (handle AS LONG, buffer AS STRING)
+    DIM sink AS LONG: sink = __MIDIPlayer_PlayFromMemory(handle, buffer, LEN(buffer))
+
+    EXIT SUB
+
+    sink = _SNDRATE ' This dummy call to _SNDRATE is to tell QB64-PE to link in the system audio libraries.
+END SUB
+
+
+FUNCTION MIDIPlayer_PlayFromFile%% (handle AS LONG, fileName AS STRING)
+    MIDIPlayer_PlayFromFile = MIDIPlayer_PlayFromMemory(handle, File_Load(fileName))
+END FUNCTION
+
+
+SUB MIDIPlayer_PlayFromFile (handle AS LONG, fileName AS STRING)
+    MIDIPlayer_PlayFromMemory handle, File_Load(fileName)
+END SUB
+
+
+FUNCTION MIDIPlayer_QueueFromMemory%% (handle AS LONG, buffer AS STRING)
+    MIDIPlayer_QueueFromMemory = __MIDIPlayer_QueueFromMemory(handle, buffer, LEN(buffer))
+END FUNCTION
+
+
+SUB MIDIPlayer_QueueFromMemory (handle AS LONG, buffer AS STRING)
+    DIM sink AS LONG: sink = __MIDIPlayer_QueueFromMemory(handle, buffer, LEN(buffer))
+END SUB
+
+
+FUNCTION MIDIPlayer_QueueFromFile%% (handle AS LONG, fileName AS STRING)
+    MIDIPlayer_QueueFromFile = MIDIPlayer_QueueFromMemory(handle, File_Load(fileName))
+END FUNCTION
+
+
+SUB MIDIPlayer_QueueFromFile (handle AS LONG, fileName AS STRING)
+    MIDIPlayer_QueueFromMemory handle, File_Load(fileName)
+END SUB
+
 '$INCLUDE:'File.bas'
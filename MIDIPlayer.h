@@ -22,19 +22,35 @@
 #include "external/rtmidi/rtmidi_c.cpp"
 #endif
 
-// This needs to be defined to link the library statically
-#define FMIDI_STATIC
-
 #include "Types.h"
-#include "external/fmidi/fmidi.cpp"
+#include "ResourceHandleManager.h"
+#include "MIDITimeline.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #include <functional>
+#include <memory>
+#include <vector>
 
-/// @brief The MIDI player singleton class.
+/// @brief A MIDI player. Every player has its own MIDI port and playback state, and all players share one scheduler
+/// thread.
 class __MIDIPlayer
 {
 public:
+    __MIDIPlayer() : rtMidiOut(nullptr), port(-1), outputMode(OutputMode::Single), outputStatus(0), userPort(DefaultPort), midiScheduler(Scheduler::GetShared()), timelinePosition(0), speed(1.0), transposeSemitones(0), haveMIDITick(false), lastMIDITick(), totalTime(0.0), currentTime(0.0), isPlayerPaused(false), volumeDirtyCounter(VolumeDirtyCounterTicks), loops(0), paused(false), volume(1.0f), tempo(1.0), transpose(0), timeSequence(0), publishedTime(0.0), publishedSpeed(1.0), publishedStamp(0), publishedTotalTime(0.0), publishedFormat(fmidi_fileformat_smf), queuedTimeline(nullptr), queuedSongs(0) {}
+
+    ~__MIDIPlayer()
+    {
+        Stop();
+    }
+
+    __MIDIPlayer(const __MIDIPlayer &) = delete;
+    __MIDIPlayer &operator=(const __MIDIPlayer &) = delete;
+
     /// @brief Retrieves the last error message associated with the MIDI player.
     /// @return A pointer to the error message string if there is an error; otherwise, an empty string.
     const char *GetErrorMessage()
@@ -157,39 +173,32 @@ public:
 
             if (rtMidiOut->ok)
             {
+                outputMode = GetOutputMode();
                 MIDIOutSysExReset(false);
+                MIDIOutFlush();
 
-                smf = fmidi_auto_mem_read(reinterpret_cast<const uint8_t *>(buffer), bufferSize);
-                if (smf)
+                if (timeline.Load(reinterpret_cast<const uint8_t *>(buffer), bufferSize))
                 {
-                    format = fmidi_mem_identify(reinterpret_cast<const uint8_t *>(buffer), bufferSize);
-                    player = fmidi_player_new(smf);
-                    if (player)
+                    timelinePosition = 0;
+                    totalTime = timeline.GetDuration();
+                    speed = tempo;
+                    transposeSemitones = transpose;
+                    for (auto &keys : noteMap)
                     {
-                        totalTime = fmidi_smf_compute_duration(smf);
-
-                        fmidi_player_event_callback(player, PlayerEventCallback, this);
-                        fmidi_player_finish_callback(player, PlayerFinishCallback, this);
-                        fmidi_player_start(player);
+                        keys.fill(NoNote);
+                    }
+                    PublishTime(0.0, false);
 
-                        midiTimer.SetCallback([this]()
+                    // Everything a tick sends goes out in one batch
+                    schedulerTask.SetCallback([this]()
                                               {
-                                                    auto now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
-                                                    
-                                                    if (haveMIDITick)
-                                                    {
-                                                        fmidi_player_tick(player, now - lastMIDITick);
-                                                        currentTime = fmidi_player_current_time(player);
-                                                    }
+                                                  auto deadline = OnSchedulerTick();
+                                                  MIDIOutFlush();
+                                                  return deadline; });
 
-                                                    haveMIDITick = true;
-                                                    lastMIDITick = now; },
-                                              std::chrono::milliseconds(TimerInterval));
+                    midiScheduler->Start(schedulerTask);
 
-                        midiTimer.Start();
-
-                        return QB_TRUE;
-                    }
+                    return QB_TRUE;
                 }
             }
         }
@@ -199,16 +208,73 @@ public:
         return QB_FALSE;
     }
 
+    /// @brief Queues a MIDI file to play once the current one has finished. The file is parsed and compiled on a
+    /// background thread and then swapped in by the scheduler at the end of the song, so the MIDI port stays open and
+    /// there is no gap between the two. Queuing another file replaces the queued one. If nothing is playing, this is
+    /// the same as PlayFromMemory().
+    /// @param buffer The MIDI file data as a byte array. This is copied, so the caller can release it right away.
+    /// @param bufferSize The size of the MIDI file data in bytes.
+    /// @return QB_TRUE if the file was queued (or playback started); QB_FALSE otherwise. A queued file that turns out to
+    /// be invalid is skipped.
+    qb_bool QueueFromMemory(const char *buffer, size_t bufferSize)
+    {
+        if (!schedulerTask.IsRunning())
+        {
+            return PlayFromMemory(buffer, bufferSize);
+        }
+
+        ClearQueue();
+
+        queuedSongs++;
+        queueLoader = std::thread([this, data = std::vector<uint8_t>(buffer, buffer + bufferSize)]()
+                                  {
+                                        auto next = std::make_unique<MIDITimeline>();
+
+                                        if (next->Load(data.data(), data.size()))
+                                        {
+                                            delete queuedTimeline.exchange(next.release());
+
+                                            // The scheduler may be idle at the end of the song
+                                            midiScheduler->Wake(schedulerTask);
+                                        }
+                                        else
+                                        {
+                                            queuedSongs--;
+                                        } });
+
+        return QB_TRUE;
+    }
+
+    /// @brief Checks if a MIDI file is waiting to be played after the current one.
+    /// @return QB_TRUE if a queued file is loading or ready; QB_FALSE otherwise.
+    qb_bool IsQueued()
+    {
+        return queuedSongs ? QB_TRUE : QB_FALSE;
+    }
+
+    /// @brief Drops the queued MIDI file (if any). This waits for the background thread if it is still parsing.
+    void ClearQueue()
+    {
+        if (queueLoader.joinable())
+        {
+            queueLoader.join();
+        }
+
+        if (auto next = queuedTimeline.exchange(nullptr))
+        {
+            delete next;
+            queuedSongs--;
+        }
+    }
+
     /// @brief Stops MIDI playback if it is currently playing and releases all related resources.
     void Stop()
     {
-        midiTimer.Stop();
+        ClearQueue();
+        midiScheduler->Stop(schedulerTask);
 
-        fmidi_player_free(player);
-        player = nullptr;
-
-        fmidi_smf_free(smf);
-        smf = nullptr;
+        timeline.Clear();
+        timelinePosition = 0;
 
         if (rtMidiOut)
         {
@@ -223,26 +289,49 @@ public:
             rtMidiOut = nullptr;
         }
 
+        // Drop anything the scheduler did not get to
+        outputBuffer.clear();
+        outputStatus = 0;
+
+        Command command;
+        while (commands.Pop(command))
+        {
+        }
+
         haveMIDITick = false;
-        lastMIDITick = 0.0;
+        lastMIDITick = Scheduler::Clock::time_point();
         totalTime = 0.0;
         currentTime = 0.0;
+        isPlayerPaused = false;
         paused = false;
         volumeDirtyCounter = VolumeDirtyCounterTicks;
+        PublishTime(0.0, false);
     }
 
     /// @brief Checks if the MIDI player is currently playing.
     /// @return QB_TRUE if the player is running; QB_FALSE otherwise.
     qb_bool IsPlaying()
     {
-        return (player && (loops || currentTime < totalTime)) ? QB_TRUE : QB_FALSE;
+        if (!schedulerTask.IsRunning())
+        {
+            return QB_FALSE;
+        }
+
+        // The queue is checked first since the scheduler publishes the next song before it leaves the queue
+        if (loops || IsQueued())
+        {
+            return QB_TRUE;
+        }
+
+        double totalTime;
+        return ReadPublishedTime(totalTime) < totalTime ? QB_TRUE : QB_FALSE;
     }
 
     /// @brief Sets the number of times the MIDI playback will loop.
     /// @param loops The number of loops to set. A value of 0 means no looping, a positive value indicates the number of times to repeat playback, while a negative value indicates an infinite loop.
     void Loop(int32_t loops)
     {
-        this->loops = loops;
+        this->loops = loops; // atomic; the scheduler only ever decrements it
     }
 
     /// @brief Checks if the MIDI player is currently set to loop.
@@ -256,40 +345,31 @@ public:
     /// @param state QB_TRUE to pause, QB_FALSE to unpause.
     void Pause(int8_t state)
     {
-        if (player)
+        if (schedulerTask.IsRunning())
         {
-            if (state)
-            {
-                midiTimer.Stop();
-                haveMIDITick = false;
-                fmidi_player_stop(player);
-                MidiOutSoundOff();
-            }
-            else
-            {
-                fmidi_player_start(player);
-                midiTimer.Start();
-            }
+            paused = state != 0;
+            PostCommand({state ? CommandType::Pause : CommandType::Resume, 0.0});
         }
     }
 
     qb_bool IsPaused()
     {
-        return midiTimer.IsRunning() ? QB_FALSE : QB_TRUE;
+        return (!schedulerTask.IsRunning() || paused) ? QB_TRUE : QB_FALSE;
     }
 
     /// @brief Gets the total time in seconds of the currently loaded MIDI file.
     /// @return The total time in seconds of the currently loaded MIDI file.
     double GetTotalTime()
     {
-        return totalTime;
+        return publishedTotalTime;
     }
 
     /// @brief Gets the current time in seconds of the currently playing MIDI file.
     /// @return The current time in seconds of the currently playing MIDI file. If the player is not running, returns 0.0.
     double GetCurrentTime()
     {
-        return currentTime;
+        double totalTime;
+        return ReadPublishedTime(totalTime);
     }
 
     /// @brief Sets the volume of the MIDI output.
@@ -297,10 +377,9 @@ public:
     void SetVolume(float volume)
     {
         volume = std::clamp(volume, 0.0f, 1.0f);
-        if (this->volume != volume)
+        if (this->volume.exchange(volume) != volume)
         {
-            this->volume = volume;
-            volumeDirtyCounter = VolumeDirtyCounterTicks;
+            PostCommand({CommandType::Volume, volume});
         }
     }
 
@@ -311,13 +390,50 @@ public:
         return volume;
     }
 
+    /// @brief Sets the playback tempo. This scales the time base of the scheduler, so it takes effect right away and
+    /// the song does not need to be reloaded. Song positions and lengths stay in song time.
+    /// @param tempo The tempo multiplier (1.0 is the tempo of the file), clamped to MinTempo - MaxTempo.
+    void SetTempo(double tempo)
+    {
+        tempo = std::clamp(tempo, MinTempo, MaxTempo);
+        if (this->tempo.exchange(tempo) != tempo)
+        {
+            PostCommand({CommandType::Tempo, tempo});
+        }
+    }
+
+    /// @brief Gets the playback tempo multiplier.
+    double GetTempo()
+    {
+        return tempo;
+    }
+
+    /// @brief Transposes all notes (except the drum channel) by a number of semitones. Notes that are held while this
+    /// changes are released at the pitch they were started at.
+    /// @param semitones The number of semitones, clamped to -MaxTranspose - MaxTranspose. Notes that end up outside the
+    /// MIDI note range are dropped.
+    void SetTranspose(int32_t semitones)
+    {
+        semitones = std::clamp(semitones, -MaxTranspose, MaxTranspose);
+        if (transpose.exchange(semitones) != semitones)
+        {
+            PostCommand({CommandType::Transpose, double(semitones)});
+        }
+    }
+
+    /// @brief Gets the transposition in semitones.
+    int32_t GetTranspose()
+    {
+        return transpose;
+    }
+
     /// @brief Seeks the MIDI playback to the specified time position.
     /// @param time The time position in seconds to seek to.
     void SeekToTime(double time)
     {
-        if (player)
+        if (schedulerTask.IsRunning())
         {
-            fmidi_player_goto_time(player, time);
+            PostCommand({CommandType::Seek, time});
         }
     }
 
@@ -325,7 +441,7 @@ public:
     /// @return The format of the currently loaded MIDI file, specified as a null-terminated string.
     const char *GetFormat()
     {
-        switch (format)
+        switch (publishedFormat)
         {
         case fmidi_fileformat_smf:
             return "Standard MIDI";
@@ -338,7 +454,7 @@ public:
         }
     }
 
-    /// @brief Retrieves the singleton instance of the MIDI player.
+    /// @brief Retrieves the default MIDI player used by the MIDI_* functions.
     static __MIDIPlayer &Instance()
     {
         static __MIDIPlayer instance;
@@ -347,91 +463,411 @@ public:
 
 private:
     static constexpr auto DefaultPort = 0;              // Default MIDI port number
-    static constexpr auto TimerInterval = 1;            // Timer interval in milliseconds
-    static constexpr auto Channels = 16;                // Number of MIDI channels
-    static constexpr auto SysExEnd = 0xF7u;             // SysEx end byte status code
+    static constexpr auto Channels = MIDITimeline::Channels;
     static constexpr auto VolumeDirtyCounterTicks = 10; // Number of MIDI ticks before sending the volume change message
-    static constexpr uint8_t SysExResetGM[] = {0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7};
-    static constexpr uint8_t SysExResetGM2[] = {0xF0, 0x7E, 0x7F, 0x09, 0x03, 0xF7};
-    static constexpr uint8_t SysExResetGS[] = {0xF0, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7};
-    static constexpr uint8_t SysExResetXG[] = {0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0xF7};
-
-    /// @brief A timer class for MIDI playback.
-    class Timer
+    static constexpr auto CommandQueueSize = 64;        // Number of pending commands (power of 2)
+    static constexpr auto MinTempo = 0.1;               // Slowest tempo multiplier
+    static constexpr auto MaxTempo = 10.0;              // Fastest tempo multiplier
+    static constexpr auto MaxTranspose = 48;            // Largest transposition in semitones (either way)
+    static constexpr auto DrumChannel = 9;              // MIDI channel 10 carries percussion and is never transposed
+    static constexpr uint8_t NoNote = 0xFFu;            // Marks a key that is not sounding in noteMap
+    static constexpr auto OutputBatchSize = 512;        // Bytes sent at most in one go (keeps the ALSA sequencer output buffer from filling up)
+
+    /// @brief A deadline-driven scheduler thread shared by all MIDI players.
+    /// Every player runs a Task whose callback returns the absolute time at which it wants to run next. The thread calls
+    /// the callbacks that are due, then sleeps on a condition variable until shortly before the earliest deadline and
+    /// spins for the rest so that events go out on time without polling. Wake() makes the thread call a task again
+    /// right away. The thread is started with the first task and lives as long as any player holds the scheduler.
+    class Scheduler
     {
     public:
-        Timer() : running(false) {}
+        using Clock = std::chrono::steady_clock;
 
-        ~Timer() { Stop(); }
+        static constexpr auto SpinTime = std::chrono::microseconds(500); // time before the deadline spent spinning
 
-        /// @brief Sets the callback function for this timer, which will be called at the given interval.
-        /// @param callback A callable object (such as a lambda or a std::function) that takes no arguments and returns void.
-        /// @param interval The interval at which the callback will be called, specified in milliseconds.
-        void SetCallback(std::function<void()> callback,
-                         std::chrono::milliseconds interval)
+        /// @brief A callback driven by the scheduler.
+        class Task
         {
-            this->callback = callback;
-            this->interval = interval;
+        public:
+            Task() : deadline(), running(false), wake(false) {}
+
+            /// @brief Sets the function that is called on every deadline. This must not be changed while the task runs.
+            /// @param callback A callable object that returns the next deadline, or Clock::time_point::max() to wait until Wake() is called.
+            void SetCallback(std::function<Clock::time_point()> callback)
+            {
+                this->callback = callback;
+            }
+
+            bool IsRunning() const { return running; }
+
+        private:
+            friend class Scheduler;
+
+            std::function<Clock::time_point()> callback;
+            Clock::time_point deadline; // owned by the scheduler thread
+            std::atomic<bool> running;
+            std::atomic<bool> wake;
+        };
+
+        Scheduler() : running(false), wake(false) {}
+
+        ~Scheduler()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running = false;
+            }
+
+            condition.notify_one();
+
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+
+        Scheduler(const Scheduler &) = delete;
+        Scheduler &operator=(const Scheduler &) = delete;
+
+        /// @brief Returns the scheduler shared by all players, creating it if there is none.
+        static std::shared_ptr<Scheduler> GetShared()
+        {
+            static std::mutex sharedMutex;
+            static std::weak_ptr<Scheduler> shared;
+
+            std::lock_guard<std::mutex> lock(sharedMutex);
+
+            auto scheduler = shared.lock();
+            if (!scheduler)
+            {
+                scheduler = std::make_shared<Scheduler>();
+                shared = scheduler;
+            }
+
+            return scheduler;
         }
 
-        /// @brief Starts the timer, which will call the callback function at the given interval.
-        /// @return true if the timer was started successfully, false otherwise.
-        bool Start()
+        /// @brief Adds a task to the scheduler. The callback is called right away.
+        /// @param task The task to add. It must stay alive until Stop() is called.
+        /// @return true if the task was started successfully, false otherwise.
+        bool Start(Task &task)
         {
-            if (!callback)
+            if (!task.callback)
             {
                 return false;
             }
 
-            if (running)
+            if (task.running)
             {
-                Stop();
+                Stop(task);
             }
 
-            running = true;
-            worker = std::thread([this]()
-                                 {
-            while (running) {
-                std::this_thread::sleep_for(interval);
+            {
+                std::lock_guard<std::mutex> lock(tasksMutex);
+
+                task.deadline = Clock::time_point::min();
+                task.running = true;
+                tasks.push_back(&task);
 
-                if (running && callback) {
-                    callback();
+                if (!worker.joinable())
+                {
+                    running = true;
+                    worker = std::thread([this]()
+                                         { Run(); });
                 }
-            } });
+            }
+
+            Wake(task);
 
             return true;
         }
 
-        /// @brief Stops the timer, halting the callback function calls. If the timer is not running, this function does nothing. If the timer is running, this function will wait for the worker thread to finish before returning.
-        void Stop()
+        /// @brief Removes a task from the scheduler. When this returns, the callback is not running and will not be called
+        /// again. If the task is not running, this function does nothing.
+        /// @param task The task to remove.
+        void Stop(Task &task)
         {
-            running = false;
+            // Taking the lock waits for the callbacks that are running right now
+            std::lock_guard<std::mutex> lock(tasksMutex);
+
+            tasks.erase(std::remove(tasks.begin(), tasks.end(), &task), tasks.end());
+            task.running = false;
+            task.wake = false;
+        }
+
+        /// @brief Makes the thread call a task as soon as possible.
+        /// @param task The task to call.
+        void Wake(Task &task)
+        {
+            task.wake = true;
 
-            if (worker.joinable())
             {
-                worker.join();
+                // Taken only so that the wake-up cannot slip in between the predicate check and the wait
+                std::lock_guard<std::mutex> lock(mutex);
+                wake = true;
             }
-        }
 
-        bool IsRunning() const { return running; }
+            condition.notify_one();
+        }
 
     private:
+        /// @brief The scheduler thread.
+        void Run()
+        {
+            auto isWoken = [this]()
+            { return wake || !running; };
+
+            while (running)
+            {
+                auto deadline = Clock::time_point::max();
+
+                {
+                    // The callbacks run with only the task list locked so that Wake() never waits for them
+                    std::lock_guard<std::mutex> lock(tasksMutex);
+
+                    auto now = Clock::now();
+
+                    for (auto task : tasks)
+                    {
+                        if (task->wake.exchange(false) || task->deadline <= now)
+                        {
+                            task->deadline = task->callback();
+                        }
+
+                        deadline = std::min(deadline, task->deadline);
+                    }
+                }
+
+                std::unique_lock<std::mutex> lock(mutex);
+
+                if (deadline == Clock::time_point::max())
+                {
+                    condition.wait(lock, isWoken);
+                }
+                else if (!condition.wait_until(lock, deadline - SpinTime, isWoken))
+                {
+                    // Spin the last stretch without holding the lock
+                    lock.unlock();
+                    while (running && !wake && Clock::now() < deadline)
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+
+                wake = false;
+            }
+        }
+
         std::thread worker;
-        bool running;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::atomic<bool> running;
+        std::atomic<bool> wake;
+
+        std::mutex tasksMutex;     // held while the callbacks run
+        std::vector<Task *> tasks; // the running tasks
+    };
 
-        std::function<void()> callback;
-        std::chrono::milliseconds interval;
+    /// @brief How messages are handed to the MIDI backend.
+    enum class OutputMode : uint8_t
+    {
+        Single,       // one message per send
+        Batch,        // all messages of a scheduler tick in one send
+        RunningStatus // as Batch, with repeated channel status bytes left out
     };
 
-    __MIDIPlayer() : rtMidiOut(nullptr), port(-1), userPort(DefaultPort), smf(nullptr), player(nullptr), haveMIDITick(false), lastMIDITick(0.0), totalTime(0.0), currentTime(0.0), loops(0), paused(false), volume(1.0f), volumeDirtyCounter(VolumeDirtyCounterTicks), format(fmidi_fileformat_smf) {}
+    /// @brief Player state changes requested by the caller. These are applied by the scheduler thread between ticks.
+    enum class CommandType : uint8_t
+    {
+        Seek,
+        Pause,
+        Resume,
+        Volume,
+        Tempo,
+        Transpose
+    };
 
-    ~__MIDIPlayer()
+    struct Command
     {
-        Stop();
+        CommandType type;
+        double value;
+    };
+
+    using EventKind = MIDITimeline::EventKind;
+    using ChannelState = MIDITimeline::ChannelState;
+    using ChaseState = MIDITimeline::ChaseState;
+
+    /// @brief A bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's design).
+    /// @tparam T The item type.
+    /// @tparam Capacity The number of slots. This must be a power of 2.
+    template <typename T, size_t Capacity>
+    class CommandQueue
+    {
+        static_assert(Capacity && !(Capacity & (Capacity - 1)), "Capacity must be a power of 2");
+
+    public:
+        CommandQueue() : head(0), tail(0)
+        {
+            for (size_t i = 0; i < Capacity; i++)
+            {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        /// @brief Adds an item to the queue.
+        /// @return false if the queue is full.
+        bool Push(const T &item)
+        {
+            auto position = tail.load(std::memory_order_relaxed);
+
+            while (true)
+            {
+                auto &cell = cells[position & (Capacity - 1)];
+                auto difference = intptr_t(cell.sequence.load(std::memory_order_acquire)) - intptr_t(position);
+
+                if (difference == 0)
+                {
+                    if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        cell.data = item;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /// @brief Removes the oldest item from the queue.
+        /// @return false if the queue is empty.
+        bool Pop(T &item)
+        {
+            auto position = head.load(std::memory_order_relaxed);
+
+            while (true)
+            {
+                auto &cell = cells[position & (Capacity - 1)];
+                auto difference = intptr_t(cell.sequence.load(std::memory_order_acquire)) - intptr_t(position + 1);
+
+                if (difference == 0)
+                {
+                    if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        item = cell.data;
+                        cell.sequence.store(position + Capacity, std::memory_order_release);
+
+                        return true;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        std::array<Cell, Capacity> cells;
+        std::atomic<size_t> head;
+        std::atomic<size_t> tail;
+    };
+
+    /// @brief Works out how the MIDI backend can take several messages in one send.
+    OutputMode GetOutputMode()
+    {
+        switch (rtmidi_out_get_current_api(rtMidiOut))
+        {
+        case RTMIDI_API_LINUX_ALSA:
+            return OutputMode::RunningStatus; // the sequencer event encoder splits the stream and tracks running status
+
+        case RTMIDI_API_WEB_MIDI_API:
+            return OutputMode::Batch; // Web MIDI takes a sequence of messages but does not allow running status
+
+        default:
+            return OutputMode::Single; // CoreMIDI, WinMM, JACK and others take one message per send
+        }
     }
 
-    __MIDIPlayer(const __MIDIPlayer &) = delete;
-    __MIDIPlayer &operator=(const __MIDIPlayer &) = delete;
+    /// @brief Sends a MIDI message or adds it to the output batch. Batched messages go out on the next MIDIOutFlush().
+    /// @param message The message bytes.
+    /// @param size The number of message bytes.
+    void MIDIOutSend(const uint8_t *message, size_t size)
+    {
+        if (outputMode == OutputMode::Single)
+        {
+            rtmidi_out_send_message(rtMidiOut, message, size);
+            return;
+        }
+
+        if (!outputBuffer.empty() && outputBuffer.size() + size > OutputBatchSize)
+        {
+            MIDIOutFlush();
+        }
+
+        auto status = message[0];
+
+        if (status >= 0x80u && status < 0xF0u)
+        {
+            // Channel messages can drop the status byte if it matches the previous one
+            if (outputMode == OutputMode::RunningStatus && status == outputStatus)
+            {
+                message++;
+                size--;
+            }
+
+            outputStatus = status;
+        }
+        else if (status >= 0xF0u && status < 0xF8u)
+        {
+            outputStatus = 0; // SysEx and system common messages cancel running status; real-time ones do not
+        }
+
+        outputBuffer.insert(outputBuffer.end(), message, message + size);
+    }
+
+    /// @brief Sends the batched messages in one go.
+    void MIDIOutFlush()
+    {
+        if (!outputBuffer.empty())
+        {
+            rtmidi_out_send_message(rtMidiOut, outputBuffer.data(), outputBuffer.size());
+            outputBuffer.clear();
+        }
+
+        outputStatus = 0; // every batch starts with a full status byte
+    }
+
+    /// @brief Sends a 2-byte channel message.
+    void MIDIOutMessage(uint8_t status, uint8_t data1)
+    {
+        uint8_t msg[]{status, data1};
+        MIDIOutSend(msg, sizeof(msg));
+    }
+
+    /// @brief Sends a 3-byte channel message.
+    void MIDIOutMessage(uint8_t status, uint8_t data1, uint8_t data2)
+    {
+        uint8_t msg[]{status, data1, data2};
+        MIDIOutSend(msg, sizeof(msg));
+    }
 
     /// @brief Stops all sounds on all MIDI channels. This is used when pausing a MIDI file playback to ensure there is no sound coming from the MIDI output.
     void MidiOutSoundOff()
@@ -443,7 +879,7 @@ private:
                 // All sound off
                 {
                     uint8_t msg[]{(uint8_t)((0b1011 << 4) | c), 120, 0};
-                    rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                    MIDIOutSend(msg, sizeof(msg));
                 }
             }
         }
@@ -456,45 +892,45 @@ private:
         if (rtMidiOut)
         {
 
-            // Send SysEx reset messages using rtmidi_out_send_message
-            rtmidi_out_send_message(rtMidiOut, SysExResetXG, sizeof(SysExResetXG));
-            rtmidi_out_send_message(rtMidiOut, SysExResetGM2, sizeof(SysExResetGM2));
-            rtmidi_out_send_message(rtMidiOut, SysExResetGM, sizeof(SysExResetGM));
+            // Send SysEx reset messages
+            MIDIOutSend(MIDITimeline::SysExResetXG, sizeof(MIDITimeline::SysExResetXG));
+            MIDIOutSend(MIDITimeline::SysExResetGM2, sizeof(MIDITimeline::SysExResetGM2));
+            MIDIOutSend(MIDITimeline::SysExResetGM, sizeof(MIDITimeline::SysExResetGM));
 
             // Loop for sending control changes and other events for each channel
             for (uint8_t c = 0; c < Channels; c++)
             {
                 {
                     uint8_t msg[]{(uint8_t)((0b1011 << 4) | c), 120, 0}; // CC 120 Channel Mute / Sound Off
-                    rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                    MIDIOutSend(msg, sizeof(msg));
                 }
 
                 {
                     uint8_t msg[]{(uint8_t)((0b1011 << 4) | c), 121, 0}; // CC 121 Reset All Controllers
-                    rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                    MIDIOutSend(msg, sizeof(msg));
                 }
 
                 if (!isXG || c != 9)
                 {
                     {
                         uint8_t msg[]{(uint8_t)((0b1011 << 4) | c), 32, 0}; // CC 32 Bank select LSB
-                        rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                        MIDIOutSend(msg, sizeof(msg));
                     }
 
                     {
                         uint8_t msg[]{(uint8_t)((0b1011 << 4) | c), 0, 0}; // CC 0 Bank select MSB
-                        rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                        MIDIOutSend(msg, sizeof(msg));
                     }
 
                     {
                         uint8_t msg[]{(uint8_t)((0b1100 << 4) | c), 0}; // Program Change 0
-                        rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                        MIDIOutSend(msg, sizeof(msg));
                     }
                 }
 
                 {
                     uint8_t msg[]{(uint8_t)((0b1110 << 4) | c), 0, 0b1000000}; // Pitch bend change
-                    rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                    MIDIOutSend(msg, sizeof(msg));
                 }
             }
 
@@ -503,123 +939,421 @@ private:
             {
                 {
                     uint8_t msg[]{(uint8_t)((0b1011 << 4) | 9), 32, 0}; // CC 32 Bank select LSB
-                    rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                    MIDIOutSend(msg, sizeof(msg));
                 }
 
                 {
                     uint8_t msg[]{(uint8_t)((0b1011 << 4) | 9), 0, 0}; // CC 0 Bank select MSB (Drum Kit in XG)
-                    rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                    MIDIOutSend(msg, sizeof(msg));
                 }
 
                 {
                     uint8_t msg[]{(uint8_t)((0b1100 << 4) | 9), 0}; // Program Change 0
-                    rtmidi_out_send_message(rtMidiOut, msg, sizeof(msg));
+                    MIDIOutSend(msg, sizeof(msg));
                 }
             }
         }
     }
 
-    /// @brief Check if the given SysEx message is a reset message.
-    /// @param data The SysEx message to check.
-    /// @returns true if the message is a reset message, false otherwise.
-    static bool IsSysExReset(const uint8_t *data)
+    /// @brief Sends a message with the note (if it has one) transposed. Note-offs and key pressure go to the key that
+    /// the note-on was sent to, even if the transposition has changed in between.
+    /// @param message The message bytes.
+    /// @param size The number of message bytes.
+    void MIDIOutTransposed(const uint8_t *message, size_t size)
     {
-        return IsSysExEqual(data, SysExResetGM) || IsSysExEqual(data, SysExResetGM2) || IsSysExEqual(data, SysExResetGS) || IsSysExEqual(data, SysExResetXG);
+        auto type = message[0] >> 4;
+        auto channel = message[0] & 0xF;
+
+        // Note-off, note-on and key pressure
+        if (size < 3 || type < 0b1000 || type > 0b1010 || channel == DrumChannel)
+        {
+            MIDIOutSend(message, size);
+            return;
+        }
+
+        auto key = message[1] & 127;
+        auto &sentKey = noteMap[channel][key];
+        int note;
+
+        if (type == 0b1001 && message[2])
+        {
+            note = key + transposeSemitones;
+            sentKey = note >= 0 && note <= 127 ? uint8_t(note) : NoNote;
+        }
+        else
+        {
+            note = sentKey != NoNote ? sentKey : key + transposeSemitones;
+
+            if (type != 0b1010)
+            {
+                sentKey = NoNote;
+            }
+        }
+
+        if (note >= 0 && note <= 127)
+        {
+            uint8_t msg[]{message[0], uint8_t(note), message[2]};
+            MIDIOutSend(msg, sizeof(msg));
+        }
     }
 
-    /// @brief Compares two SysEx messages to determine if they are equal.
-    /// @param a Pointer to the first SysEx message.
-    /// @param b Pointer to the second SysEx message.
-    /// @return true if both SysEx messages are equal, false otherwise.
-    static bool IsSysExEqual(const uint8_t *a, const uint8_t *b)
+    /// @brief Sends a timeline event to the MIDI output.
+    /// @param event The event to send.
+    void SendEvent(const MIDITimeline::Event &event)
     {
-        while ((*a != SysExEnd) && (*b != SysExEnd) && (*a == *b))
+        switch (event.kind)
         {
-            a++;
-            b++;
+        case EventKind::ResetXG:
+            MIDIOutSysExReset(true);
+            break;
+
+        case EventKind::Reset:
+            MIDIOutSysExReset(false);
+            break;
+
+        default:
+            MIDIOutTransposed(timeline.GetEventData(event), event.length);
+        }
+
+        if (volumeDirtyCounter > 0)
+        {
+            volumeDirtyCounter--;
+        }
+        else if (volumeDirtyCounter == 0)
+        {
+            uint16_t volume = this->volume * 16383; // clamp volume to [0.0, 1.0] and scale volume to 14-bit range
+
+            // Construct the SysEx message for setting the global volume
+            uint8_t msg[]{0xF0, 0x7F, 0x7F, 0x04, 0x01, uint8_t(volume & 0x7F), uint8_t((volume >> 7) & 0x7F), 0xF7};
+
+            MIDIOutSend(msg, sizeof(msg));
+
+            volumeDirtyCounter--; // push the counter to a negative value to prevent sending the volume change message again
         }
+    }
 
-        return (*a == *b);
+    /// @brief Checks if playback has gone past the last event.
+    bool IsTimelineFinished() const
+    {
+        return timelinePosition >= timeline.GetSize() && currentTime > totalTime;
     }
 
-    /// @brief Callback function to handle MIDI player events.
-    /// @param event Pointer to the MIDI event structure.
-    /// @param data Pointer to user data, expected to be a __MIDIPlayer instance.
-    static void PlayerEventCallback(const fmidi_event_t *event, void *data)
+    /// @brief Moves the playback position forward and sends every event that has become due.
+    /// @param delta The wall-clock time that has passed in seconds.
+    void AdvanceTimeline(double delta)
     {
-        auto player = static_cast<__MIDIPlayer *>(data);
+        auto advance = delta * speed;
+        currentTime += advance;
 
-        if (event->type == fmidi_event_message)
+        while (timelinePosition < timeline.GetSize() && timeline.GetEvent(timelinePosition).time < currentTime)
         {
-            if (IsSysExEqual(event->data, SysExResetXG))
+            SendEvent(timeline.GetEvent(timelinePosition));
+            timelinePosition++;
+        }
+
+        if (IsTimelineFinished())
+        {
+            OnTimelineEnd(advance);
+        }
+    }
+
+    /// @brief Resets every channel and sends only what differs from the reset state.
+    /// @param state The state of all channels.
+    void SendChaseState(const ChaseState &state)
+    {
+        for (uint8_t c = 0; c < Channels; c++)
+        {
+            const auto &channel = state[c];
+            const uint8_t cc = (0b1011 << 4) | c;
+
+            MIDIOutMessage(cc, 120, 0); // CC 120 Channel Mute / Sound Off
+            MIDIOutMessage(cc, 121, 0); // CC 121 Reset All Controllers
+
+            // Bank select has to go before the program change
+            if (channel.controls[0] != ChannelState::Unset)
             {
-                player->MIDIOutSysExReset(true);
+                MIDIOutMessage(cc, 0, channel.controls[0]);
             }
-            else if (IsSysExReset(event->data))
+            if (channel.controls[32] != ChannelState::Unset)
             {
-                player->MIDIOutSysExReset(false);
+                MIDIOutMessage(cc, 32, channel.controls[32]);
             }
-            else
+
+            MIDIOutMessage((0b1100 << 4) | c, channel.program);
+
+            for (uint8_t id = 1; id < 120; id++)
+            {
+                if (id != 32 && channel.controls[id] != ChannelState::Unset)
+                {
+                    MIDIOutMessage(cc, id, channel.controls[id]);
+                }
+            }
+
+            auto haveRPN = false;
+            for (uint8_t r = 0; r < ChannelState::RPNCount; r++)
             {
-                rtmidi_out_send_message(player->rtMidiOut, event->data, event->datalen);
+                if (channel.rpns[r] != ChannelState::UnsetRPN)
+                {
+                    MIDIOutMessage(cc, 101, 0);
+                    MIDIOutMessage(cc, 100, r);
+                    MIDIOutMessage(cc, 6, channel.rpns[r] >> 7);
+                    MIDIOutMessage(cc, 38, channel.rpns[r] & 0x7F);
+                    haveRPN = true;
+                }
             }
 
-            if (player->volumeDirtyCounter > 0)
+            // Leave the same RPN selected as the song had (or deselect what we used)
+            if (haveRPN || channel.rpnSelection != ChannelState::NullRPN)
             {
-                player->volumeDirtyCounter--;
+                MIDIOutMessage(cc, 101, channel.rpnSelection >> 7);
+                MIDIOutMessage(cc, 100, channel.rpnSelection & 0x7F);
             }
-            else if (player->volumeDirtyCounter == 0)
+
+            if (channel.pitchBend != ChannelState::PitchBendCenter)
             {
-                uint16_t volume = player->volume * 16383; // clamp volume to [0.0, 1.0] and scale volume to 14-bit range
+                MIDIOutMessage((0b1110 << 4) | c, channel.pitchBend & 0x7F, channel.pitchBend >> 7);
+            }
 
-                // Construct the SysEx message for setting the global volume
-                uint8_t msg[]{0xF0, 0x7F, 0x7F, 0x04, 0x01, uint8_t(volume & 0x7F), uint8_t((volume >> 7) & 0x7F), 0xF7};
+            if (channel.pressure != ChannelState::Unset)
+            {
+                MIDIOutMessage((0b1101 << 4) | c, channel.pressure);
+            }
+        }
+    }
 
-                rtmidi_out_send_message(player->rtMidiOut, msg, sizeof(msg));
+    /// @brief Moves the playback position to the given time. The position is found with a binary search. The channel
+    /// state is rebuilt from the nearest earlier snapshot and the events after it, and then sent in one batch.
+    /// @param time The time position in seconds.
+    void GoToTime(double time)
+    {
+        timelinePosition = timeline.FindPosition(time);
+        currentTime = time;
 
-                player->volumeDirtyCounter--; // push the counter to a negative value to prevent sending the volume change message again
-            }
+        // The chase state silences every channel
+        for (auto &keys : noteMap)
+        {
+            keys.fill(NoNote);
+        }
+
+        SendChaseState(timeline.GetChaseState(timelinePosition));
+    }
+
+    /// @brief Queues a command for the scheduler thread and wakes it up.
+    /// @param command The command to queue.
+    void PostCommand(const Command &command)
+    {
+        // The queue only fills up if the scheduler is stalled; give it a chance to drain
+        while (!commands.Push(command))
+        {
+            midiScheduler->Wake(schedulerTask);
+            std::this_thread::yield();
         }
+
+        midiScheduler->Wake(schedulerTask);
     }
 
-    /// @brief Callback function to handle the finish of a MIDI player.
-    /// @param data Pointer to user data, expected to be a __MIDIPlayer instance.
-    static void PlayerFinishCallback(void *data)
+    /// @brief Reads the playback position and the length of the song it belongs to as published by the scheduler.
+    /// @param totalTime Receives the length of the song in seconds.
+    /// @return The playback position in seconds.
+    double ReadPublishedTime(double &totalTime)
     {
-        auto player = static_cast<__MIDIPlayer *>(data);
+        uint32_t sequence;
+        double time, speed;
+        Scheduler::Clock::rep stamp;
 
-        if (player->loops > 0)
+        // Retry if the scheduler published a new time while we were reading
+        do
         {
-            player->loops--;
+            sequence = timeSequence;
+            time = publishedTime;
+            speed = publishedSpeed;
+            stamp = publishedStamp;
+            totalTime = publishedTotalTime;
+        } while ((sequence & 1) || sequence != timeSequence);
+
+        // The scheduler only wakes up for events, so add the time that has passed since the last one
+        if (stamp)
+        {
+            time += std::chrono::duration<double>(Scheduler::Clock::now() - Scheduler::Clock::time_point(Scheduler::Clock::duration(stamp))).count() * speed;
+        }
 
-            if (player->loops > 0)
+        return time;
+    }
+
+    /// @brief Publishes the playback position and the song it belongs to for the caller. Only the scheduler thread (or
+    /// PlayFromMemory() and Stop() while the scheduler is stopped) writes it, so a sequence counter is enough to let readers detect torn reads.
+    /// @param time The position in seconds.
+    /// @param isAdvancing True if the position moves on from lastMIDITick at the player speed.
+    void PublishTime(double time, bool isAdvancing)
+    {
+        timeSequence++; // odd: write in progress
+        publishedTime = time;
+        publishedSpeed = speed;
+        publishedStamp = isAdvancing ? lastMIDITick.time_since_epoch().count() : 0;
+        publishedTotalTime = totalTime;
+        publishedFormat = timeline.GetFormat();
+        timeSequence++;
+    }
+
+    /// @brief Applies a command from the caller. This runs on the scheduler thread.
+    /// @param command The command to apply.
+    void ApplyCommand(const Command &command)
+    {
+        switch (command.type)
+        {
+        case CommandType::Seek:
+            GoToTime(command.value);
+            break;
+
+        case CommandType::Pause:
+            if (!isPlayerPaused)
             {
-                fmidi_player_rewind(player->player);
-                fmidi_player_start(player->player);
+                isPlayerPaused = true;
+                MidiOutSoundOff();
             }
+            break;
+
+        case CommandType::Resume:
+            if (isPlayerPaused)
+            {
+                isPlayerPaused = false;
+            }
+            break;
+
+        case CommandType::Volume:
+            volumeDirtyCounter = VolumeDirtyCounterTicks;
+            break;
+
+        case CommandType::Tempo:
+            speed = command.value;
+            break;
+
+        case CommandType::Transpose:
+            transposeSemitones = int32_t(command.value);
+            break;
         }
-        else if (player->loops < 0)
+    }
+
+    /// @brief Advances the player to the current time, applies pending commands and works out when the next event is due.
+    /// This runs on the scheduler thread and is the only place where the player is touched while the scheduler runs.
+    /// @return The time of the next event, or Scheduler::Clock::time_point::max() if nothing is due until the player is woken up.
+    Scheduler::Clock::time_point OnSchedulerTick()
+    {
+        if (timeline.IsEmpty())
         {
-            fmidi_player_rewind(player->player);
-            fmidi_player_start(player->player);
+            return Scheduler::Clock::time_point::max();
+        }
+
+        auto now = Scheduler::Clock::now();
+
+        if (haveMIDITick && !isPlayerPaused)
+        {
+            AdvanceTimeline(std::chrono::duration<double>(now - lastMIDITick).count());
+        }
+
+        // Commands take effect at this point in time; time spent paused is skipped
+        haveMIDITick = true;
+        lastMIDITick = now;
+
+        Command command;
+        while (commands.Pop(command))
+        {
+            ApplyCommand(command);
+        }
+
+        if (isPlayerPaused)
+        {
+            PublishTime(currentTime, false);
+
+            return Scheduler::Clock::time_point::max();
+        }
+
+        PublishTime(currentTime, true);
+
+        if (IsTimelineFinished() || speed <= 0.0)
+        {
+            return Scheduler::Clock::time_point::max();
+        }
+
+        // Wake up for the next event, or at the end of the song to handle looping
+        auto eventTime = timelinePosition < timeline.GetSize() ? timeline.GetEvent(timelinePosition).time : totalTime;
+        auto wait = std::max(eventTime - currentTime, 0.0) / speed;
+
+        return now + std::chrono::duration_cast<Scheduler::Clock::duration>(std::chrono::duration<double>(wait));
+    }
+
+    /// @brief Handles the end of the song. Playback restarts from the top if there are loops left, otherwise the queued
+    /// song (if any) takes over.
+    /// @param advance How far the playback position moved in the tick that ran past the end.
+    void OnTimelineEnd(double advance)
+    {
+        // The caller may change the loop count at any time, so only decrement the value we saw
+        auto loops = this->loops.load();
+        while (loops > 0 && !this->loops.compare_exchange_weak(loops, loops - 1))
+        {
+        }
+
+        if (loops > 1 || loops < 0)
+        {
+            timelinePosition = 0;
+            currentTime = 0.0;
+        }
+        else if (auto next = std::unique_ptr<MIDITimeline>(queuedTimeline.exchange(nullptr)))
+        {
+            // Carry over the time the tick ran past the end so that the next song keeps the beat. If the song ended
+            // in an earlier tick the queued song was late and simply starts now.
+            auto overshoot = currentTime - totalTime;
+
+            timeline = std::move(*next);
+            timelinePosition = 0;
+            totalTime = timeline.GetDuration();
+            currentTime = overshoot <= advance ? overshoot : 0.0;
+
+            // Only leave the queue once the new song is visible to IsPlaying()
+            PublishTime(currentTime, false);
+            queuedSongs--;
+
+            MIDIOutSysExReset(false);
+            AdvanceTimeline(0.0);
         }
     }
 
     RtMidiOutPtr rtMidiOut;
     int64_t port;
+    OutputMode outputMode;
+    std::vector<uint8_t> outputBuffer; // messages batched by MIDIOutSend()
+    uint8_t outputStatus;              // running status of outputBuffer (0 if none)
     uint32_t userPort;
-    fmidi_smf_t *smf;
-    fmidi_player_t *player;
-    Timer midiTimer;
+    MIDITimeline timeline;
+    std::shared_ptr<Scheduler> midiScheduler;
+    Scheduler::Task schedulerTask;
+    std::thread queueLoader;
+    CommandQueue<Command, CommandQueueSize> commands;
+    // Owned by the scheduler thread while it runs
+    size_t timelinePosition;
+    double speed;
+    int32_t transposeSemitones;
+    std::array<std::array<uint8_t, 128>, Channels> noteMap; // the key every sounding note was sent to
     bool haveMIDITick;
-    double lastMIDITick;
+    Scheduler::Clock::time_point lastMIDITick;
     double totalTime;
     double currentTime;
-    int32_t loops;
-    bool paused;
-    float volume;
+    bool isPlayerPaused;
     int volumeDirtyCounter;
-    fmidi_fileformat_t format;
+    // Shared with the caller
+    std::atomic<int32_t> loops;
+    std::atomic<bool> paused;
+    std::atomic<float> volume;
+    std::atomic<double> tempo;
+    std::atomic<int32_t> transpose;
+    std::atomic<uint32_t> timeSequence;
+    std::atomic<double> publishedTime;
+    std::atomic<double> publishedSpeed;
+    std::atomic<Scheduler::Clock::rep> publishedStamp;
+    std::atomic<double> publishedTotalTime;
+    std::atomic<fmidi_fileformat_t> publishedFormat;
+    std::atomic<MIDITimeline *> queuedTimeline; // compiled by queueLoader and taken by the scheduler
+    std::atomic<uint32_t> queuedSongs; // loading or waiting in queuedTimeline
 };
 
 const char *MIDI_GetErrorMessage()
@@ -652,6 +1386,21 @@ inline qb_bool __MIDI_PlayFromMemory(const char *buffer, size_t bufferSize)
     return __MIDIPlayer::Instance().PlayFromMemory(buffer, bufferSize);
 }
 
+inline qb_bool __MIDI_QueueFromMemory(const char *buffer, size_t bufferSize)
+{
+    return __MIDIPlayer::Instance().QueueFromMemory(buffer, bufferSize);
+}
+
+qb_bool MIDI_IsQueued()
+{
+    return __MIDIPlayer::Instance().IsQueued();
+}
+
+void MIDI_ClearQueue()
+{
+    __MIDIPlayer::Instance().ClearQueue();
+}
+
 void MIDI_Stop()
 {
     __MIDIPlayer::Instance().Stop();
@@ -711,3 +1460,204 @@ void MIDI_SeekToTime(double time)
 {
     __MIDIPlayer::Instance().SeekToTime(time);
 }
+
+void MIDI_SetTempo(double tempo)
+{
+    __MIDIPlayer::Instance().SetTempo(tempo);
+}
+
+double MIDI_GetTempo()
+{
+    return __MIDIPlayer::Instance().GetTempo();
+}
+
+void MIDI_SetTranspose(int32_t semitones)
+{
+    __MIDIPlayer::Instance().SetTranspose(semitones);
+}
+
+int32_t MIDI_GetTranspose()
+{
+    return __MIDIPlayer::Instance().GetTranspose();
+}
+
+static ResourceHandleManager<__MIDIPlayer> g_MIDIPlayerManager;
+
+/// @brief Creates a MIDI player that plays independently of the default one (and of any other player).
+/// @return A handle to the player.
+inline ResourceHandleManager<__MIDIPlayer>::Handle MIDIPlayer_Create()
+{
+    return g_MIDIPlayerManager.CreateHandle(std::make_unique<__MIDIPlayer>());
+}
+
+/// @brief Stops a player created using MIDIPlayer_Create() and deletes it.
+/// @param handle A player handle.
+inline void MIDIPlayer_Delete(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    g_MIDIPlayerManager.ReleaseHandle(handle);
+}
+
+inline const char *MIDIPlayer_GetErrorMessage(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->GetErrorMessage() : "Invalid handle";
+}
+
+/// @brief Selects the MIDI port a player opens on the next MIDIPlayer_PlayFromMemory(). Every player can use a different port.
+/// @param handle A player handle.
+/// @param portIndex The index of the MIDI port (see MIDI_GetPortCount() and MIDI_GetPortName()).
+inline qb_bool MIDIPlayer_SetPort(ResourceHandleManager<__MIDIPlayer>::Handle handle, uint32_t portIndex)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->SetPort(portIndex) : QB_FALSE;
+}
+
+inline uint32_t MIDIPlayer_GetPort(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->GetPort() : 0u;
+}
+
+inline qb_bool __MIDIPlayer_PlayFromMemory(ResourceHandleManager<__MIDIPlayer>::Handle handle, const char *buffer, size_t bufferSize)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->PlayFromMemory(buffer, bufferSize) : QB_FALSE;
+}
+
+inline qb_bool __MIDIPlayer_QueueFromMemory(ResourceHandleManager<__MIDIPlayer>::Handle handle, const char *buffer, size_t bufferSize)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->QueueFromMemory(buffer, bufferSize) : QB_FALSE;
+}
+
+inline qb_bool MIDIPlayer_IsQueued(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->IsQueued() : QB_FALSE;
+}
+
+inline void MIDIPlayer_ClearQueue(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    if (player)
+    {
+        player->ClearQueue();
+    }
+}
+
+inline void MIDIPlayer_Stop(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    if (player)
+    {
+        player->Stop();
+    }
+}
+
+inline qb_bool MIDIPlayer_IsPlaying(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->IsPlaying() : QB_FALSE;
+}
+
+inline void MIDIPlayer_Loop(ResourceHandleManager<__MIDIPlayer>::Handle handle, int32_t loops)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    if (player)
+    {
+        player->Loop(loops);
+    }
+}
+
+inline qb_bool MIDIPlayer_IsLooping(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->IsLooping() : QB_FALSE;
+}
+
+inline void MIDIPlayer_Pause(ResourceHandleManager<__MIDIPlayer>::Handle handle, int8_t state)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    if (player)
+    {
+        player->Pause(state);
+    }
+}
+
+inline qb_bool MIDIPlayer_IsPaused(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->IsPaused() : QB_TRUE;
+}
+
+inline double MIDIPlayer_GetTotalTime(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->GetTotalTime() : 0.0;
+}
+
+inline double MIDIPlayer_GetCurrentTime(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->GetCurrentTime() : 0.0;
+}
+
+inline void MIDIPlayer_SetVolume(ResourceHandleManager<__MIDIPlayer>::Handle handle, float volume)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    if (player)
+    {
+        player->SetVolume(volume);
+    }
+}
+
+inline float MIDIPlayer_GetVolume(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->GetVolume() : 0.0f;
+}
+
+inline void MIDIPlayer_SeekToTime(ResourceHandleManager<__MIDIPlayer>::Handle handle, double time)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    if (player)
+    {
+        player->SeekToTime(time);
+    }
+}
+
+inline const char *MIDIPlayer_GetFormat(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->GetFormat() : "Unknown";
+}
+
+inline void MIDIPlayer_SetTempo(ResourceHandleManager<__MIDIPlayer>::Handle handle, double tempo)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    if (player)
+    {
+        player->SetTempo(tempo);
+    }
+}
+
+inline double MIDIPlayer_GetTempo(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->GetTempo() : 1.0;
+}
+
+inline void MIDIPlayer_SetTranspose(ResourceHandleManager<__MIDIPlayer>::Handle handle, int32_t semitones)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    if (player)
+    {
+        player->SetTranspose(semitones);
+    }
+}
+
+inline int32_t MIDIPlayer_GetTranspose(ResourceHandleManager<__MIDIPlayer>::Handle handle)
+{
+    auto player = g_MIDIPlayerManager.GetResource(handle);
+    return player ? player->GetTranspose() : 0;
+}
@@ -0,0 +1,1211 @@
+//----------------------------------------------------------------------------------------------------------------------
+// MIDI synthesizer for QB64-PE using SoftSynth and SoundFont 2 instruments
+// Copyright (c) 2024 Samuel Gomes
+//
+// https://freepats.zenvoid.org/sf2/sfspec24.pdf
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Debug.h"
+#include "Types.h"
+#include "SoftSynth.h"
+#include "MIDITimeline.h"
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <map>
+#include <memory>
+#include <vector>
+
+/// @brief Plays MIDI files (or live MIDI messages) using SoftSynth voices and SoundFont 2 instruments.
+/// The SF2 samples are loaded as SoftSynth sounds and every preset is flattened into a list of zones (the preset and
+/// instrument levels are combined at load time), so a note on only has to find the zones matching its key and velocity.
+/// Each zone gets a SoftSynth voice with a DAHDSR volume envelope that is updated every CONTROL_FRAMES frames. When all
+/// voices are busy the quietest releasing voice, or failing that the oldest one, is stolen.
+/// Only a subset of SF2 is supported: no modulators, filters, LFOs, modulation envelope or 24-bit samples.
+class MIDISoftSynth
+{
+public:
+    static constexpr uint32_t CONTROL_FRAMES = 64;    // envelopes and MIDI events are applied at this granularity at most
+    static constexpr uint8_t PERCUSSION_CHANNEL = 9;  // MIDI channel 10
+    static constexpr uint16_t PERCUSSION_BANK = 128;  // SF2 bank used for percussion presets
+    static constexpr double RELEASE_TAIL = 5.0;       // seconds rendered at most after the end of the song
+    static constexpr auto SILENCE_DB = 100.0f;        // envelope attenuation at which a voice is stopped
+
+    /// @brief A playable region of a preset with all SF2 generators resolved.
+    struct Zone
+    {
+        struct Envelope
+        {
+            float delay;   // seconds
+            float attack;  // seconds
+            float hold;    // seconds
+            float decay;   // seconds for 100 dB
+            float sustain; // attenuation in dB
+            float release; // seconds for 100 dB
+        };
+
+        uint8_t keyLow, keyHigh;
+        uint8_t velocityLow, velocityHigh;
+        int32_t sound;               // SoftSynth sound
+        uint32_t start, end;         // frames in sound (end is exclusive)
+        uint32_t loopStart, loopEnd; // frames in sound (loopEnd is exclusive)
+        bool isLooping;
+        uint32_t sampleRate;
+        uint8_t rootKey;
+        float tune;                  // cents
+        float scaleTuning;           // cents per key
+        float gain;                  // initial attenuation as a linear gain
+        float pan;                   // -1.0 - 1.0
+        uint16_t exclusiveClass;     // 0 = none
+        Envelope envelope;
+    };
+
+    /// @brief Volume envelope stages.
+    enum class Stage : uint8_t
+    {
+        Off,
+        Delay,
+        Attack,
+        Hold,
+        Decay,
+        Sustain,
+        Release
+    };
+
+    /// @brief The state of one SoftSynth voice used by the driver.
+    struct Voice
+    {
+        const Zone *zone;
+        uint8_t channel;     // MIDI channel
+        uint8_t note;        // MIDI note that started the voice
+        uint8_t velocity;
+        bool isSustained;    // note off was received while the sustain pedal was down
+        Stage stage;
+        float stageTime;     // seconds spent in the current stage
+        float attenuation;   // envelope attenuation in dB (decay, sustain and release)
+        float envelopeGain;  // envelope output (0.0 - 1.0)
+        uint64_t stamp;      // when the voice was started
+    };
+
+    MIDISoftSynth(uint32_t firstVoice, uint32_t voiceCount) : firstVoice(firstVoice), firstSound(0), soundCount(0), voices(voiceCount), stamp(0), position(0), frame(0), passFrame(0), isLooping(false)
+    {
+        Restart();
+    }
+
+    ~MIDISoftSynth()
+    {
+        StopAll();
+        UnloadSounds();
+    }
+
+    MIDISoftSynth(const MIDISoftSynth &) = delete;
+    MIDISoftSynth &operator=(const MIDISoftSynth &) = delete;
+
+    /// @brief Loads the presets and samples of a SoundFont 2 file. The samples are appended to the SoftSynth sounds
+    /// (replacing those of a previously loaded SoundFont).
+    /// @param data The file contents.
+    /// @param size The size of data in bytes.
+    /// @return True if the file was recognized and has at least one preset.
+    bool LoadSoundFont(const uint8_t *data, size_t size)
+    {
+        if (size < 12 or std::memcmp(data, "RIFF", 4) or std::memcmp(data + 8, "sfbk", 4))
+        {
+            return false;
+        }
+
+        Chunks chunks = {};
+        FindChunks(data + 12, std::min<size_t>(size - 12, ReadU32(data + 4) - 4), chunks);
+
+        if (!chunks.smpl.data or !chunks.phdr.data or !chunks.pbag.data or !chunks.pgen.data or !chunks.inst.data or !chunks.ibag.data or !chunks.igen.data or !chunks.shdr.data or
+            chunks.phdr.size < 2 * PHDR_SIZE or chunks.inst.size < 2 * INST_SIZE or chunks.shdr.size < 2 * SHDR_SIZE)
+        {
+            return false;
+        }
+
+        StopAll();
+        UnloadSounds();
+        presets.clear();
+
+        LoadSamples(chunks);
+        LoadPresets(chunks);
+
+        return !presets.empty();
+    }
+
+    /// @brief Loads a MIDI file (SMF, XMI or MUS) and rewinds to the start.
+    /// @return True if the file has anything to play.
+    bool LoadMIDI(const uint8_t *data, size_t size)
+    {
+        auto isLoaded = timeline.Load(data, size);
+        Restart();
+
+        return isLoaded;
+    }
+
+    void SetLooping(bool looping)
+    {
+        isLooping = looping;
+    }
+
+    /// @brief Returns true while the song is playing (always true for a looping song). Voices that are still sounding
+    /// at the end of the song are given up to RELEASE_TAIL seconds to fade out.
+    bool IsPlaying() const
+    {
+        if (timeline.IsEmpty())
+        {
+            return false;
+        }
+
+        if (isLooping or position < timeline.GetSize())
+        {
+            return true;
+        }
+
+        auto endFrame = passFrame + TimeToFrame(timeline.GetDuration());
+
+        return frame < endFrame or (frame < endFrame + TimeToFrame(RELEASE_TAIL) and GetActiveVoices());
+    }
+
+    uint32_t GetFirstVoice() const
+    {
+        return firstVoice;
+    }
+
+    double GetLength() const
+    {
+        return timeline.GetDuration();
+    }
+
+    double GetPosition() const
+    {
+        return double(frame - passFrame) / g_SoftSynth->sampleRate;
+    }
+
+    uint32_t GetActiveVoices() const
+    {
+        return uint32_t(std::count_if(voices.begin(), voices.end(), [](const Voice &voice)
+                                      { return voice.stage != Stage::Off; }));
+    }
+
+    /// @brief Renders stereo interleaved FP32 samples (overwriting buffer). The blocks passed to SoftSynth are split at
+    /// MIDI events, so every event starts at its exact frame. This mixes every SoftSynth voice, not just the ones used
+    /// by the driver.
+    /// @return True while the song is playing.
+    bool Render(float *buffer, uint32_t frames)
+    {
+        std::fill(buffer, buffer + size_t(frames) * 2, 0.0f);
+
+        uint32_t done = 0;
+        while (done < frames)
+        {
+            auto count = std::min(frames - done, CONTROL_FRAMES);
+
+            // Play the events that are due and stop the block at the next one
+            auto nextFrame = ProcessEvents();
+            if (nextFrame > frame)
+            {
+                count = uint32_t(std::min<uint64_t>(count, nextFrame - frame));
+            }
+
+            UpdateVoices(float(count) / g_SoftSynth->sampleRate);
+            __SoftSynth_Update(buffer + size_t(done) * 2, count);
+
+            done += count;
+            frame += count;
+        }
+
+        return IsPlaying();
+    }
+
+    /// @brief Moves the playback position. All voices are stopped and the program and controller state at the new
+    /// position is rebuilt from the timeline, so notes start sounding again from the next note on.
+    /// @param seconds The new position in seconds (clamped to the length of the song).
+    void Seek(double seconds)
+    {
+        seconds = std::clamp(seconds, 0.0, timeline.GetDuration());
+
+        StopAll();
+        position = timeline.FindPosition(seconds);
+        channels = timeline.GetChaseState(position);
+        frame = TimeToFrame(seconds);
+        passFrame = 0;
+    }
+
+    /// @brief Stops all voices, resets the channel state and rewinds to the start.
+    void Restart()
+    {
+        StopAll();
+        MIDITimeline::ResetChaseState(channels);
+        position = 0;
+        frame = 0;
+        passFrame = 0;
+    }
+
+    /// @brief Plays a MIDI message right away (at the start of the next rendered block).
+    /// @param message The message bytes. SysEx resets are recognized; other SysEx messages are ignored.
+    /// @param length The number of bytes in message.
+    void SendMessage(const uint8_t *message, uint32_t length)
+    {
+        if (!length)
+        {
+            return;
+        }
+
+        auto kind = MIDITimeline::EventKind::Message;
+        if (message[0] == 0xF0u and message[length - 1] == MIDITimeline::SysExEnd and MIDITimeline::IsSysExReset(message))
+        {
+            kind = MIDITimeline::EventKind::Reset;
+        }
+
+        ProcessMessage(kind, message, length);
+    }
+
+private:
+    static constexpr size_t PHDR_SIZE = 38;
+    static constexpr size_t BAG_SIZE = 4;
+    static constexpr size_t GEN_SIZE = 4;
+    static constexpr size_t INST_SIZE = 22;
+    static constexpr size_t SHDR_SIZE = 46;
+
+    /// @brief SF2 generators used by the driver.
+    enum Generator : uint16_t
+    {
+        GEN_START_OFFSET = 0,
+        GEN_END_OFFSET = 1,
+        GEN_LOOP_START_OFFSET = 2,
+        GEN_LOOP_END_OFFSET = 3,
+        GEN_START_COARSE_OFFSET = 4,
+        GEN_END_COARSE_OFFSET = 12,
+        GEN_PAN = 17,
+        GEN_DELAY_VOL_ENV = 33,
+        GEN_ATTACK_VOL_ENV = 34,
+        GEN_HOLD_VOL_ENV = 35,
+        GEN_DECAY_VOL_ENV = 36,
+        GEN_SUSTAIN_VOL_ENV = 37,
+        GEN_RELEASE_VOL_ENV = 38,
+        GEN_INSTRUMENT = 41,
+        GEN_KEY_RANGE = 43,
+        GEN_VELOCITY_RANGE = 44,
+        GEN_LOOP_START_COARSE_OFFSET = 45,
+        GEN_INITIAL_ATTENUATION = 48,
+        GEN_LOOP_END_COARSE_OFFSET = 50,
+        GEN_COARSE_TUNE = 51,
+        GEN_FINE_TUNE = 52,
+        GEN_SAMPLE_ID = 53,
+        GEN_SAMPLE_MODES = 54,
+        GEN_SCALE_TUNING = 56,
+        GEN_EXCLUSIVE_CLASS = 57,
+        GEN_OVERRIDING_ROOT_KEY = 58,
+        GEN_COUNT = 61
+    };
+
+    /// @brief The generators of one zone. Generators that are not set fall back to the global zone and then to the
+    /// default value.
+    struct GeneratorList
+    {
+        std::array<int16_t, GEN_COUNT> values;
+        std::bitset<GEN_COUNT> isSet;
+
+        void Set(uint16_t generator, int16_t value)
+        {
+            if (generator < GEN_COUNT)
+            {
+                values[generator] = value;
+                isSet.set(generator);
+            }
+        }
+
+        int32_t Get(Generator generator, const GeneratorList *global, int32_t defaultValue) const
+        {
+            return isSet[generator] ? values[generator] : global and global->isSet[generator] ? global->values[generator] : defaultValue;
+        }
+    };
+
+    /// @brief A chunk in the file.
+    struct Chunk
+    {
+        const uint8_t *data;
+        size_t size;
+    };
+
+    struct Chunks
+    {
+        Chunk smpl, phdr, pbag, pgen, inst, ibag, igen, shdr;
+    };
+
+    static uint16_t ReadU16(const uint8_t *p) { return uint16_t(p[0] | (p[1] << 8)); }
+
+    static uint32_t ReadU32(const uint8_t *p) { return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24); }
+
+    /// @brief Walks a list of RIFF chunks (and the LIST chunks in it) and picks the ones needed.
+    static void FindChunks(const uint8_t *data, size_t size, Chunks &chunks)
+    {
+        size_t offset = 0;
+        while (offset + 8 <= size)
+        {
+            auto id = data + offset;
+            auto chunkSize = std::min<size_t>(ReadU32(data + offset + 4), size - offset - 8);
+            auto chunkData = data + offset + 8;
+
+            if (!std::memcmp(id, "LIST", 4) and chunkSize >= 4)
+            {
+                FindChunks(chunkData + 4, chunkSize - 4, chunks);
+            }
+            else
+            {
+                static constexpr const char *names[] = {"smpl", "phdr", "pbag", "pgen", "inst", "ibag", "igen", "shdr"};
+                Chunk *targets[] = {&chunks.smpl, &chunks.phdr, &chunks.pbag, &chunks.pgen, &chunks.inst, &chunks.ibag, &chunks.igen, &chunks.shdr};
+
+                for (size_t i = 0; i < std::size(names); i++)
+                {
+                    if (!std::memcmp(id, names[i], 4))
+                    {
+                        *targets[i] = Chunk{chunkData, chunkSize};
+                    }
+                }
+            }
+
+            offset += 8 + chunkSize + (chunkSize & 1); // chunks are word aligned
+        }
+    }
+
+    /// @brief Loads every sample header as a SoftSynth sound (16-bit mono). ROM samples are skipped.
+    void LoadSamples(const Chunks &chunks)
+    {
+        auto sampleFrames = chunks.smpl.size / sizeof(int16_t);
+
+        firstSound = int32_t(g_SoftSynth->sounds.size());
+        soundCount = uint32_t(chunks.shdr.size / SHDR_SIZE - 1); // the last header is the terminator
+
+        samples.resize(soundCount);
+        for (uint32_t i = 0; i < soundCount; i++)
+        {
+            auto p = chunks.shdr.data + i * SHDR_SIZE;
+            auto &sample = samples[i];
+
+            sample.start = std::min<size_t>(ReadU32(p + 20), sampleFrames);
+            sample.end = std::clamp<size_t>(ReadU32(p + 24), sample.start, sampleFrames);
+            sample.loopStart = ReadU32(p + 28);
+            sample.loopEnd = ReadU32(p + 32);
+            sample.sampleRate = ReadU32(p + 36);
+            sample.originalPitch = p[40];
+            sample.pitchCorrection = int8_t(p[41]);
+
+            if (ReadU16(p + 44) & 0x8000u)
+            {
+                sample.end = sample.start; // ROM sample
+            }
+
+            __SoftSynth_LoadSound(firstSound + i, reinterpret_cast<const char *>(chunks.smpl.data + sample.start * sizeof(int16_t)),
+                                  uint32_t((sample.end - sample.start) * sizeof(int16_t)), sizeof(int16_t), 1);
+        }
+    }
+
+    /// @brief Reads the generators of every zone in a bag range.
+    static std::vector<GeneratorList> ReadZones(const Chunk &bags, const Chunk &generators, size_t firstBag, size_t lastBag)
+    {
+        std::vector<GeneratorList> zones;
+
+        auto bagCount = bags.size / BAG_SIZE;
+        auto generatorCount = generators.size / GEN_SIZE;
+
+        for (auto b = firstBag; b < lastBag and b + 1 < bagCount; b++)
+        {
+            GeneratorList zone = {};
+            auto first = ReadU16(bags.data + b * BAG_SIZE);
+            auto last = std::min<size_t>(ReadU16(bags.data + (b + 1) * BAG_SIZE), generatorCount);
+
+            for (size_t g = first; g < last; g++)
+            {
+                auto p = generators.data + g * GEN_SIZE;
+                zone.Set(ReadU16(p), int16_t(ReadU16(p + 2)));
+            }
+
+            zones.push_back(zone);
+        }
+
+        return zones;
+    }
+
+    /// @brief Flattens every preset zone / instrument zone pair into a Zone.
+    void LoadPresets(const Chunks &chunks)
+    {
+        auto presetCount = chunks.phdr.size / PHDR_SIZE - 1;
+        auto instrumentCount = chunks.inst.size / INST_SIZE - 1;
+
+        // Read all instruments first since presets share them
+        std::vector<std::vector<GeneratorList>> instruments(instrumentCount);
+        for (size_t i = 0; i < instrumentCount; i++)
+        {
+            auto p = chunks.inst.data + i * INST_SIZE;
+            instruments[i] = ReadZones(chunks.ibag, chunks.igen, ReadU16(p + 20), ReadU16(p + 20 + INST_SIZE));
+        }
+
+        for (size_t i = 0; i < presetCount; i++)
+        {
+            auto p = chunks.phdr.data + i * PHDR_SIZE;
+            auto key = PresetKey(ReadU16(p + 22), ReadU16(p + 20));
+            auto presetZones = ReadZones(chunks.pbag, chunks.pgen, ReadU16(p + 24), ReadU16(p + 24 + PHDR_SIZE));
+
+            // A first zone without an instrument is the global zone
+            const GeneratorList *presetGlobal = nullptr;
+            if (!presetZones.empty() and !presetZones[0].isSet[GEN_INSTRUMENT])
+            {
+                presetGlobal = &presetZones[0];
+            }
+
+            auto &zones = presets[key];
+            zones.clear();
+
+            for (const auto &presetZone : presetZones)
+            {
+                if (!presetZone.isSet[GEN_INSTRUMENT] or size_t(uint16_t(presetZone.values[GEN_INSTRUMENT])) >= instrumentCount)
+                {
+                    continue;
+                }
+
+                const auto &instrumentZones = instruments[uint16_t(presetZone.values[GEN_INSTRUMENT])];
+
+                const GeneratorList *instrumentGlobal = nullptr;
+                if (!instrumentZones.empty() and !instrumentZones[0].isSet[GEN_SAMPLE_ID])
+                {
+                    instrumentGlobal = &instrumentZones[0];
+                }
+
+                for (const auto &instrumentZone : instrumentZones)
+                {
+                    Zone zone;
+                    if (instrumentZone.isSet[GEN_SAMPLE_ID] and MakeZone(presetZone, presetGlobal, instrumentZone, instrumentGlobal, zone))
+                    {
+                        zones.push_back(zone);
+                    }
+                }
+            }
+
+            if (zones.empty())
+            {
+                presets.erase(key);
+            }
+        }
+    }
+
+    /// @brief Combines a preset zone with an instrument zone. Preset generators are added to the instrument ones and
+    /// the key and velocity ranges are intersected.
+    /// @return False if the zone can never be played.
+    bool MakeZone(const GeneratorList &preset, const GeneratorList *presetGlobal, const GeneratorList &instrument, const GeneratorList *instrumentGlobal, Zone &zone) const
+    {
+        auto sampleId = uint16_t(instrument.values[GEN_SAMPLE_ID]);
+        if (sampleId >= soundCount or samples[sampleId].end <= samples[sampleId].start)
+        {
+            return false;
+        }
+
+        const auto &sample = samples[sampleId];
+
+        // Instrument value (or default) plus the preset offset
+        auto get = [&](Generator generator, int32_t defaultValue)
+        {
+            return instrument.Get(generator, instrumentGlobal, defaultValue) + preset.Get(generator, presetGlobal, 0);
+        };
+
+        auto getOffset = [&](Generator fine, Generator coarse)
+        {
+            return instrument.Get(fine, instrumentGlobal, 0) + instrument.Get(coarse, instrumentGlobal, 0) * 32768;
+        };
+
+        // The minimum (and default) of -12000 timecents means no time at all
+        auto timecents = [&](Generator generator)
+        {
+            auto value = get(generator, -12000);
+            return value > -12000 ? std::exp2(float(value) / 1200.0f) : 0.0f;
+        };
+
+        auto keyRange = uint16_t(instrument.Get(GEN_KEY_RANGE, instrumentGlobal, 0x7F00));
+        auto presetKeyRange = uint16_t(preset.Get(GEN_KEY_RANGE, presetGlobal, 0x7F00));
+        auto velocityRange = uint16_t(instrument.Get(GEN_VELOCITY_RANGE, instrumentGlobal, 0x7F00));
+        auto presetVelocityRange = uint16_t(preset.Get(GEN_VELOCITY_RANGE, presetGlobal, 0x7F00));
+
+        zone.keyLow = std::max(keyRange & 0xFF, presetKeyRange & 0xFF);
+        zone.keyHigh = std::min(keyRange >> 8, presetKeyRange >> 8);
+        zone.velocityLow = std::max(velocityRange & 0xFF, presetVelocityRange & 0xFF);
+        zone.velocityHigh = std::min(velocityRange >> 8, presetVelocityRange >> 8);
+        if (zone.keyLow > zone.keyHigh or zone.velocityLow > zone.velocityHigh)
+        {
+            return false;
+        }
+
+        // Sample addresses are relative to the sound, which only holds the sample itself
+        auto length = int64_t(sample.end - sample.start);
+        auto clampFrame = [length](int64_t value)
+        {
+            return uint32_t(std::clamp<int64_t>(value, 0, length));
+        };
+
+        zone.sound = firstSound + sampleId;
+        zone.start = clampFrame(getOffset(GEN_START_OFFSET, GEN_START_COARSE_OFFSET));
+        zone.end = clampFrame(length + getOffset(GEN_END_OFFSET, GEN_END_COARSE_OFFSET));
+        zone.loopStart = clampFrame(int64_t(sample.loopStart) - int64_t(sample.start) + getOffset(GEN_LOOP_START_OFFSET, GEN_LOOP_START_COARSE_OFFSET));
+        zone.loopEnd = clampFrame(int64_t(sample.loopEnd) - int64_t(sample.start) + getOffset(GEN_LOOP_END_OFFSET, GEN_LOOP_END_COARSE_OFFSET));
+        zone.isLooping = (instrument.Get(GEN_SAMPLE_MODES, instrumentGlobal, 0) & 1) and zone.loopEnd > zone.loopStart + 1;
+        if (zone.end <= zone.start)
+        {
+            return false;
+        }
+
+        auto rootKey = instrument.Get(GEN_OVERRIDING_ROOT_KEY, instrumentGlobal, -1);
+        zone.sampleRate = sample.sampleRate ? sample.sampleRate : g_SoftSynth->sampleRate;
+        zone.rootKey = uint8_t(rootKey >= 0 and rootKey <= 127 ? rootKey : sample.originalPitch <= 127 ? sample.originalPitch : 60);
+        zone.tune = float(get(GEN_COARSE_TUNE, 0) * 100 + get(GEN_FINE_TUNE, 0) + sample.pitchCorrection);
+        zone.scaleTuning = float(get(GEN_SCALE_TUNING, 100));
+        zone.gain = std::pow(10.0f, -std::max(get(GEN_INITIAL_ATTENUATION, 0), 0) / 200.0f); // centibels
+        zone.pan = std::clamp(get(GEN_PAN, 0) / 500.0f, -1.0f, 1.0f);
+        zone.exclusiveClass = uint16_t(instrument.Get(GEN_EXCLUSIVE_CLASS, instrumentGlobal, 0));
+
+        zone.envelope.delay = timecents(GEN_DELAY_VOL_ENV);
+        zone.envelope.attack = timecents(GEN_ATTACK_VOL_ENV);
+        zone.envelope.hold = timecents(GEN_HOLD_VOL_ENV);
+        zone.envelope.decay = timecents(GEN_DECAY_VOL_ENV);
+        zone.envelope.sustain = std::clamp(get(GEN_SUSTAIN_VOL_ENV, 0) / 10.0f, 0.0f, SILENCE_DB);
+        zone.envelope.release = std::max(timecents(GEN_RELEASE_VOL_ENV), float(CONTROL_FRAMES) / g_SoftSynth->sampleRate); // at least one block to avoid clicks
+
+        return true;
+    }
+
+    static uint32_t PresetKey(uint16_t bank, uint16_t program) { return (uint32_t(bank) << 7) | (program & 127); }
+
+    /// @brief Finds the zones for a channel's current program. Missing melodic banks fall back to the same program in
+    /// bank 0 and missing drum kits to the standard kit.
+    const std::vector<Zone> *FindPreset(uint8_t channel) const
+    {
+        const auto &state = channels[channel];
+        auto isPercussion = channel == PERCUSSION_CHANNEL;
+        auto bank = isPercussion ? PERCUSSION_BANK : uint16_t(state.GetControl(0, 0));
+
+        for (auto key : {PresetKey(bank, state.program), isPercussion ? PresetKey(bank, 0) : PresetKey(0, state.program)})
+        {
+            auto preset = presets.find(key);
+            if (preset != presets.end())
+            {
+                return &preset->second;
+            }
+        }
+
+        return nullptr;
+    }
+
+    uint64_t TimeToFrame(double seconds) const { return uint64_t(seconds * g_SoftSynth->sampleRate + 0.5); }
+
+    /// @brief Plays every event that is due at the current frame and handles looping.
+    /// @return The frame of the next event (UINT64_MAX if there is none).
+    uint64_t ProcessEvents()
+    {
+        while (!timeline.IsEmpty())
+        {
+            while (position < timeline.GetSize())
+            {
+                const auto &event = timeline.GetEvent(position);
+                auto eventFrame = passFrame + TimeToFrame(event.time);
+                if (eventFrame > frame)
+                {
+                    return eventFrame;
+                }
+
+                ProcessMessage(event.kind, timeline.GetEventData(event), event.length);
+                position++;
+            }
+
+            auto endFrame = passFrame + TimeToFrame(timeline.GetDuration());
+            if (!isLooping or endFrame == passFrame)
+            {
+                break;
+            }
+
+            if (endFrame > frame)
+            {
+                return endFrame;
+            }
+
+            passFrame = endFrame;
+            position = 0;
+            ReleaseAll();
+        }
+
+        return UINT64_MAX;
+    }
+
+    void ProcessMessage(MIDITimeline::EventKind kind, const uint8_t *message, uint32_t length)
+    {
+        MIDITimeline::UpdateChaseState(channels, kind, message, length);
+
+        if (kind != MIDITimeline::EventKind::Message)
+        {
+            ReleaseAll();
+            return;
+        }
+
+        if (message[0] >= 0xF0u or length < 2)
+        {
+            return;
+        }
+
+        auto channel = uint8_t(message[0] & 0xF);
+        auto data1 = uint8_t(message[1] & 127);
+        auto data2 = uint8_t(length >= 3 ? message[2] & 127 : 0);
+
+        switch (message[0] >> 4)
+        {
+        case 0b1000: // note off
+            NoteOff(channel, data1);
+            break;
+
+        case 0b1001: // note on
+            if (length >= 3 and data2)
+            {
+                NoteOn(channel, data1, data2);
+            }
+            else
+            {
+                NoteOff(channel, data1);
+            }
+            break;
+
+        case 0b1011: // control change
+            if (length >= 3)
+            {
+                ControlChange(channel, data1, data2);
+            }
+            break;
+
+        case 0b1110: // pitch bend
+            for (uint32_t v = 0; v < voices.size(); v++)
+            {
+                if (voices[v].stage != Stage::Off and voices[v].channel == channel)
+                {
+                    UpdateFrequency(v);
+                }
+            }
+            break;
+        }
+    }
+
+    void NoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
+    {
+        auto preset = FindPreset(channel);
+        if (!preset)
+        {
+            return;
+        }
+
+        auto noteStamp = stamp; // voices started by this note-on have newer stamps
+
+        for (const auto &zone : *preset)
+        {
+            if (note < zone.keyLow or note > zone.keyHigh or velocity < zone.velocityLow or velocity > zone.velocityHigh)
+            {
+                continue;
+            }
+
+            // A new note cuts off the notes of the same exclusive class (e.g. open and closed hi-hat), but not the layers
+            // (e.g. stereo zones) that this note-on has already started
+            if (zone.exclusiveClass)
+            {
+                for (uint32_t v = 0; v < voices.size(); v++)
+                {
+                    if (voices[v].stage != Stage::Off and voices[v].channel == channel and voices[v].stamp <= noteStamp and voices[v].zone->exclusiveClass == zone.exclusiveClass)
+                    {
+                        StopVoice(v);
+                    }
+                }
+            }
+
+            auto v = AllocateVoice();
+            auto &voice = voices[v];
+
+            voice.zone = &zone;
+            voice.channel = channel;
+            voice.note = note;
+            voice.velocity = velocity;
+            voice.isSustained = false;
+            voice.stage = Stage::Delay;
+            voice.stageTime = 0.0f;
+            voice.attenuation = 0.0f;
+            voice.envelopeGain = 0.0f;
+            voice.stamp = ++stamp;
+
+            UpdateFrequency(v);
+            UpdatePan(v);
+            SoftSynth_SetVoiceVolume(firstVoice + v, 0.0f);
+            SoftSynth_PlayVoice(firstVoice + v, zone.sound, zone.start, zone.isLooping ? SoftSynth::Voice::PlayMode::FORWARD_LOOP : SoftSynth::Voice::PlayMode::FORWARD,
+                                zone.isLooping ? zone.loopStart : zone.start, zone.isLooping ? zone.loopEnd : zone.end - 1);
+        }
+    }
+
+    void NoteOff(uint8_t channel, uint8_t note)
+    {
+        auto isSustainDown = channels[channel].GetControl(64, 0) >= 64;
+
+        for (auto &voice : voices)
+        {
+            if (voice.stage != Stage::Off and voice.stage != Stage::Release and !voice.isSustained and voice.channel == channel and voice.note == note)
+            {
+                if (isSustainDown)
+                {
+                    voice.isSustained = true;
+                }
+                else
+                {
+                    ReleaseVoice(voice);
+                }
+            }
+        }
+    }
+
+    void ControlChange(uint8_t channel, uint8_t id, uint8_t value)
+    {
+        for (uint32_t v = 0; v < voices.size(); v++)
+        {
+            auto &voice = voices[v];
+            if (voice.stage == Stage::Off or voice.channel != channel)
+            {
+                continue;
+            }
+
+            switch (id)
+            {
+            case 6: // data entry (the pitch bend range may have changed)
+            case 38:
+                UpdateFrequency(v);
+                break;
+
+            case 10: // pan
+                UpdatePan(v);
+                break;
+
+            case 64: // sustain pedal
+                if (value < 64 and voice.isSustained)
+                {
+                    ReleaseVoice(voice);
+                }
+                break;
+
+            case 120: // all sound off
+                StopVoice(v);
+                break;
+
+            case 121: // reset all controllers
+                if (voice.isSustained)
+                {
+                    ReleaseVoice(voice);
+                }
+                UpdateFrequency(v);
+                break;
+
+            case 123: // all notes off (and the mode changes that imply it)
+            case 124:
+            case 125:
+            case 126:
+            case 127:
+                if (voice.stage != Stage::Release and !voice.isSustained)
+                {
+                    if (channels[channel].GetControl(64, 0) >= 64)
+                    {
+                        voice.isSustained = true;
+                    }
+                    else
+                    {
+                        ReleaseVoice(voice);
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    /// @brief Picks a voice for a new zone: a free one, then the quietest releasing one, then the oldest one.
+    uint32_t AllocateVoice()
+    {
+        uint32_t best = 0;
+        auto bestScore = INFINITY;
+
+        for (uint32_t v = 0; v < voices.size(); v++)
+        {
+            const auto &voice = voices[v];
+            if (voice.stage == Stage::Off)
+            {
+                return v;
+            }
+
+            // Releasing voices score by loudness (0 - 1), the others by age (above 1)
+            auto score = voice.stage == Stage::Release ? voice.envelopeGain : 2.0f + float(voice.stamp) / float(stamp + 1);
+            if (score < bestScore)
+            {
+                bestScore = score;
+                best = v;
+            }
+        }
+
+        StopVoice(best);
+
+        return best;
+    }
+
+    void ReleaseVoice(Voice &voice)
+    {
+        // The release works on the attenuation, so pick up from wherever the attack got to
+        if (voice.stage == Stage::Delay or voice.stage == Stage::Attack)
+        {
+            voice.attenuation = voice.envelopeGain > 0.0f ? std::min(-20.0f * std::log10(voice.envelopeGain), SILENCE_DB) : SILENCE_DB;
+        }
+
+        voice.stage = Stage::Release;
+        voice.stageTime = 0.0f;
+        voice.isSustained = false;
+    }
+
+    void StopVoice(uint32_t v)
+    {
+        voices[v].stage = Stage::Off;
+        voices[v].isSustained = false;
+
+        if (g_SoftSynth and firstVoice + v < g_SoftSynth->voices.size())
+        {
+            SoftSynth_StopVoice(firstVoice + v);
+        }
+    }
+
+    void ReleaseAll()
+    {
+        for (auto &voice : voices)
+        {
+            if (voice.stage != Stage::Off and voice.stage != Stage::Release)
+            {
+                ReleaseVoice(voice);
+            }
+        }
+    }
+
+    void StopAll()
+    {
+        for (uint32_t v = 0; v < voices.size(); v++)
+        {
+            StopVoice(v);
+        }
+    }
+
+    /// @brief Empties the sounds loaded from the last SoundFont (the sound slots stay allocated).
+    void UnloadSounds()
+    {
+        if (g_SoftSynth)
+        {
+            for (uint32_t i = 0; i < soundCount and firstSound + i < g_SoftSynth->sounds.size(); i++)
+            {
+                g_SoftSynth->sounds[firstSound + i] = std::vector<float>();
+            }
+
+            // Give the slots back if nothing was loaded after them
+            if (soundCount and firstSound + soundCount == g_SoftSynth->sounds.size())
+            {
+                g_SoftSynth->sounds.resize(firstSound);
+            }
+        }
+
+        samples.clear();
+        soundCount = 0;
+    }
+
+    /// @brief Sets the playback rate from the key, the zone tuning and the channel pitch bend.
+    void UpdateFrequency(uint32_t v)
+    {
+        const auto &voice = voices[v];
+        const auto &zone = *voice.zone;
+
+        auto cents = (int(voice.note) - int(zone.rootKey)) * zone.scaleTuning + zone.tune + channels[voice.channel].GetPitchBend() * 100.0f;
+        auto frequency = zone.sampleRate * std::exp2(cents / 1200.0f);
+
+        SoftSynth_SetVoiceFrequency(firstVoice + v, std::max(uint32_t(frequency + 0.5f), 1u));
+    }
+
+    void UpdatePan(uint32_t v)
+    {
+        const auto &voice = voices[v];
+        auto pan = (channels[voice.channel].GetControl(10, 64) - 64) / 63.0f;
+
+        SoftSynth_SetVoiceBalance(firstVoice + v, std::clamp(voice.zone->pan + pan, -1.0f, 1.0f));
+    }
+
+    /// @brief Moves the volume envelope forward.
+    /// @return The envelope gain at the start of the step.
+    static float AdvanceEnvelope(Voice &voice, float delta)
+    {
+        const auto &envelope = voice.zone->envelope;
+
+        // Skip the timed stages that have run out (including zero length ones) and carry the extra time over
+        if (voice.stage == Stage::Delay and voice.stageTime >= envelope.delay)
+        {
+            voice.stageTime -= envelope.delay;
+            voice.stage = Stage::Attack;
+        }
+
+        if (voice.stage == Stage::Attack and voice.stageTime >= envelope.attack)
+        {
+            voice.stageTime -= envelope.attack;
+            voice.stage = Stage::Hold;
+        }
+
+        if (voice.stage == Stage::Hold and voice.stageTime >= envelope.hold)
+        {
+            voice.stageTime -= envelope.hold;
+            voice.stage = Stage::Decay;
+        }
+
+        switch (voice.stage)
+        {
+        case Stage::Attack:
+            voice.envelopeGain = voice.stageTime / envelope.attack; // linear in amplitude
+            break;
+
+        case Stage::Hold:
+            voice.envelopeGain = 1.0f;
+            break;
+
+        case Stage::Decay:
+            voice.attenuation = envelope.decay > 0.0f ? voice.stageTime * SILENCE_DB / envelope.decay : SILENCE_DB; // linear in dB
+            if (voice.attenuation >= envelope.sustain)
+            {
+                voice.attenuation = envelope.sustain;
+                voice.stage = Stage::Sustain;
+            }
+            voice.envelopeGain = std::pow(10.0f, -voice.attenuation / 20.0f);
+            break;
+
+        case Stage::Sustain:
+            break;
+
+        case Stage::Release:
+            voice.envelopeGain = voice.attenuation < SILENCE_DB ? std::pow(10.0f, -voice.attenuation / 20.0f) : 0.0f;
+            voice.attenuation += delta * SILENCE_DB / envelope.release;
+            break;
+
+        default:
+            voice.envelopeGain = 0.0f;
+        }
+
+        voice.stageTime += delta;
+
+        return voice.envelopeGain;
+    }
+
+    /// @brief Advances the envelopes and sets the SoftSynth voice volumes for the next block.
+    void UpdateVoices(float delta)
+    {
+        for (uint32_t v = 0; v < voices.size(); v++)
+        {
+            auto &voice = voices[v];
+            if (voice.stage == Stage::Off)
+            {
+                continue;
+            }
+
+            // One-shot samples end by themselves
+            if (g_SoftSynth->voices[firstVoice + v].sound == SoftSynth::Voice::NO_SOUND)
+            {
+                voice.stage = Stage::Off;
+                continue;
+            }
+
+            auto envelopeGain = AdvanceEnvelope(voice, delta);
+            if (voice.stage == Stage::Release and voice.attenuation >= SILENCE_DB)
+            {
+                StopVoice(v);
+                continue;
+            }
+
+            // GM recommends 40 log10 curves for velocity, volume and expression
+            const auto &channel = channels[voice.channel];
+            auto gain = voice.velocity / 127.0f * channel.GetControl(7, 100) / 127.0f * channel.GetControl(11, 127) / 127.0f;
+
+            SoftSynth_SetVoiceVolume(firstVoice + v, envelopeGain * voice.zone->gain * gain * gain);
+        }
+    }
+
+    /// @brief Sample header fields needed to build the zones.
+    struct Sample
+    {
+        size_t start, end; // frames in the smpl chunk
+        uint32_t loopStart, loopEnd;
+        uint32_t sampleRate;
+        uint8_t originalPitch;
+        int8_t pitchCorrection; // cents
+    };
+
+    uint32_t firstVoice;  // first SoftSynth voice used by the driver
+    int32_t firstSound;   // SoftSynth sound of the first sample
+    uint32_t soundCount;
+    std::vector<Sample> samples;
+    std::map<uint32_t, std::vector<Zone>> presets; // by PresetKey()
+    std::vector<Voice> voices;
+    MIDITimeline::ChaseState channels;
+    uint64_t stamp; // voice age counter
+    MIDITimeline timeline;
+    size_t position;    // next event to play
+    uint64_t frame;     // output frames rendered since the last seek
+    uint64_t passFrame; // frame at which the current pass through the song started
+    bool isLooping;
+};
+
+static std::unique_ptr<MIDISoftSynth> g_MIDISoftSynth; // global MIDI driver object
+
+/// @brief Sets up the MIDI driver. SoftSynth must be initialized first. The driver appends its voices to the SoftSynth
+/// voices, so SoftSynth_SetTotalVoices() must not be called while the driver is in use.
+/// @param voices The number of voices used for MIDI playback (the polyphony).
+/// @return True if the driver is ready.
+inline qb_bool MIDISoftSynth_Initialize(uint32_t voices)
+{
+    if (g_MIDISoftSynth)
+    {
+        return QB_TRUE;
+    }
+
+    if (!g_SoftSynth or !voices)
+    {
+        error(QB_ERROR_ILLEGAL_FUNCTION_CALL);
+        return QB_FALSE;
+    }
+
+    auto firstVoice = uint32_t(g_SoftSynth->voices.size());
+    g_SoftSynth->voices.resize(firstVoice + voices);
+    g_MIDISoftSynth = std::make_unique<MIDISoftSynth>(firstVoice, voices);
+
+    return QB_TRUE;
+}
+
+/// @brief Frees the driver, its sounds and its voices.
+inline void MIDISoftSynth_Finalize()
+{
+    if (g_MIDISoftSynth and g_SoftSynth)
+    {
+        g_SoftSynth->voices.resize(std::min(g_SoftSynth->voices.size(), size_t(g_MIDISoftSynth->GetFirstVoice())));
+    }
+
+    g_MIDISoftSynth.reset();
+}
+
+inline qb_bool MIDISoftSynth_IsInitialized()
+{
+    return TO_QB_BOOL(g_MIDISoftSynth != nullptr);
+}
+
+/// @brief Loads a SoundFont 2 file from memory.
+/// @param buffer The file contents.
+/// @param size The size of buffer in bytes.
+/// @return True if the file was recognized and has at least one preset.
+inline qb_bool MIDISoftSynth_LoadSoundFont(const char *buffer, uint32_t size)
+{
+    if (!g_MIDISoftSynth or !buffer)
+    {
+        error(QB_ERROR_ILLEGAL_FUNCTION_CALL);
+        return QB_FALSE;
+    }
+
+    return TO_QB_BOOL(g_MIDISoftSynth->LoadSoundFont(reinterpret_cast<const uint8_t *>(buffer), size));
+}
+
+/// @brief Loads a MIDI file (SMF, XMI or MUS) from memory.
+/// @param buffer The file contents.
+/// @param size The size of buffer in bytes.
+/// @return True if the file was recognized and has anything to play.
+inline qb_bool MIDISoftSynth_LoadMIDI(const char *buffer, uint32_t size)
+{
+    if (!g_MIDISoftSynth or !buffer)
+    {
+        error(QB_ERROR_ILLEGAL_FUNCTION_CALL);
+        return QB_FALSE;
+    }
+
+    return TO_QB_BOOL(g_MIDISoftSynth->LoadMIDI(reinterpret_cast<const uint8_t *>(buffer), size));
+}
+
+/// @brief Renders the next block of the song through SoftSynth. This can be called as fast as needed to render
+/// offline. Use this instead of SoftSynth_Update() while the driver is in use.
+/// @param buffer A stereo interleaved FP32 buffer that is overwritten.
+/// @param frames The number of frames to render.
+/// @return True while the song is playing.
+inline qb_bool MIDISoftSynth_Render(float *buffer, uint32_t frames)
+{
+    if (!g_MIDISoftSynth or !buffer)
+    {
+        error(QB_ERROR_ILLEGAL_FUNCTION_CALL);
+        return QB_FALSE;
+    }
+
+    return TO_QB_BOOL(g_MIDISoftSynth->Render(buffer, frames));
+}
+
+inline qb_bool MIDISoftSynth_IsPlaying()
+{
+    return TO_QB_BOOL(g_MIDISoftSynth and g_MIDISoftSynth->IsPlaying());
+}
+
+inline void MIDISoftSynth_SetLooping(qb_bool looping)
+{
+    if (!g_MIDISoftSynth)
+    {
+        error(QB_ERROR_ILLEGAL_FUNCTION_CALL);
+        return;
+    }
+
+    g_MIDISoftSynth->SetLooping(bool(looping));
+}
+
+/// @brief Returns the length of the song in seconds.
+inline double MIDISoftSynth_GetLength()
+{
+    return g_MIDISoftSynth ? g_MIDISoftSynth->GetLength() : 0.0;
+}
+
+/// @brief Returns the playback position in seconds.
+inline double MIDISoftSynth_GetPosition()
+{
+    return g_MIDISoftSynth ? g_MIDISoftSynth->GetPosition() : 0.0;
+}
+
+/// @brief Seeks to a position in the song.
+/// @param seconds The new position in seconds.
+inline void MIDISoftSynth_Seek(double seconds)
+{
+    if (!g_MIDISoftSynth)
+    {
+        error(QB_ERROR_ILLEGAL_FUNCTION_CALL);
+        return;
+    }
+
+    g_MIDISoftSynth->Seek(seconds);
+}
+
+/// @brief Plays a MIDI channel message right away. This works with or without a song loaded.
+/// @param status The status byte.
+/// @param data1 The first data byte.
+/// @param data2 The second data byte (ignored by 2-byte messages).
+inline void MIDISoftSynth_SendMessage(uint8_t status, uint8_t data1, uint8_t data2)
+{
+    if (!g_MIDISoftSynth)
+    {
+        error(QB_ERROR_ILLEGAL_FUNCTION_CALL);
+        return;
+    }
+
+    uint8_t message[] = {status, data1, data2};
+    auto type = status >> 4;
+    g_MIDISoftSynth->SendMessage(message, type == 0b1100 or type == 0b1101 ? 2 : 3);
+}
+
+/// @brief Returns the number of driver voices that are playing.
+inline uint32_t MIDISoftSynth_GetActiveVoices()
+{
+    return g_MIDISoftSynth ? g_MIDISoftSynth->GetActiveVoices() : 0;
+}
@@ -0,0 +1,386 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Precompiled MIDI event timeline using fmidi
+// Copyright (c) 2024 Samuel Gomes
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+// This needs to be defined to link the library statically
+#define FMIDI_STATIC
+
+#include "Types.h"
+#include "external/fmidi/fmidi.cpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/// @brief A MIDI file compiled into one flat array of events.
+/// All tracks are merged through the fmidi sequencer (which resolves the tempo map), so every event has an absolute time
+/// in seconds. Only MIDI messages are kept, their bytes are packed into a single buffer and SysEx resets are classified
+/// up front. The per-channel controller state is recorded every few events so that a seek can rebuild it quickly.
+class MIDITimeline
+{
+public:
+    static constexpr auto Channels = 16;                // Number of MIDI channels
+    static constexpr auto SysExEnd = 0xF7u;             // SysEx end byte status code
+    static constexpr auto ChaseSnapshotInterval = 1024; // Number of events between two chase snapshots
+    static constexpr uint8_t SysExResetGM[] = {0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7};
+    static constexpr uint8_t SysExResetGM2[] = {0xF0, 0x7E, 0x7F, 0x09, 0x03, 0xF7};
+    static constexpr uint8_t SysExResetGS[] = {0xF0, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7};
+    static constexpr uint8_t SysExResetXG[] = {0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0xF7};
+
+    /// @brief How an event is sent. SysEx resets are expanded into a full reset sequence.
+    enum class EventKind : uint8_t
+    {
+        Message,
+        Reset,
+        ResetXG
+    };
+
+    /// @brief A MIDI message. The bytes are stored in the timeline (see GetEventData()).
+    struct Event
+    {
+        double time; // seconds from the start of the song
+        uint32_t offset;
+        uint32_t length;
+        EventKind kind;
+    };
+
+    /// @brief The program and controller state of one MIDI channel. This is tracked so that a seek can put the output
+    /// in the same state as if the song had been played up to that point.
+    struct ChannelState
+    {
+        static constexpr uint8_t Unset = 0xFFu;
+        static constexpr uint16_t UnsetRPN = 0xFFFFu;
+        static constexpr uint16_t NullRPN = 0x3FFFu; // RPN 127/127
+        static constexpr auto RPNCount = 5;          // pitch bend range, fine tune, coarse tune, tuning program, tuning bank
+        static constexpr uint16_t PitchBendCenter = 0x2000u;
+
+        uint8_t program;
+        uint8_t pressure;                    // Unset if not set
+        uint16_t pitchBend;                  // 14-bit
+        uint16_t rpnSelection;               // (MSB << 7) | LSB; NullRPN if nothing (or an NRPN) is selected
+        std::array<uint16_t, RPNCount> rpns; // 14-bit values; UnsetRPN if not set
+        std::array<uint8_t, 128> controls;   // Unset if not set
+
+        /// @brief Sets the power-on state.
+        void Reset()
+        {
+            program = 0;
+            controls.fill(Unset);
+            rpns.fill(UnsetRPN);
+            ResetControllers();
+        }
+
+        /// @brief Applies Reset All Controllers (CC 121) as described by GM RP-015.
+        void ResetControllers()
+        {
+            controls[1] = Unset;  // modulation
+            controls[11] = Unset; // expression
+            for (auto id = 64; id <= 69; id++)
+            {
+                controls[id] = Unset; // pedals and hold
+            }
+            pressure = Unset;
+            pitchBend = PitchBendCenter;
+            rpnSelection = NullRPN;
+        }
+
+        /// @brief Returns a controller value, or defaultValue if the song has not set it.
+        uint8_t GetControl(uint8_t id, uint8_t defaultValue) const
+        {
+            return controls[id] != Unset ? controls[id] : defaultValue;
+        }
+
+        /// @brief Returns the pitch bend range in semitones (RPN 0, 2 semitones by default).
+        float GetPitchBendRange() const
+        {
+            return rpns[0] != UnsetRPN ? float(rpns[0] >> 7) + float(rpns[0] & 0x7F) / 100.0f : 2.0f;
+        }
+
+        /// @brief Returns the pitch bend in semitones.
+        float GetPitchBend() const
+        {
+            return (int(pitchBend) - int(PitchBendCenter)) / float(PitchBendCenter) * GetPitchBendRange();
+        }
+
+        /// @brief Updates the state with a control change.
+        /// @param id The controller number.
+        /// @param value The controller value.
+        void Control(uint8_t id, uint8_t value)
+        {
+            switch (id)
+            {
+            case 6: // data entry MSB
+                if (rpnSelection < RPNCount)
+                {
+                    auto &rpn = rpns[rpnSelection];
+                    rpn = (value << 7) | (rpn != UnsetRPN ? rpn & 0x7F : 0);
+                }
+                break;
+
+            case 38: // data entry LSB
+                if (rpnSelection < RPNCount)
+                {
+                    auto &rpn = rpns[rpnSelection];
+                    rpn = ((rpn != UnsetRPN ? rpn : 0) & ~0x7F) | value;
+                }
+                break;
+
+            case 98: // NRPN LSB
+            case 99: // NRPN MSB
+                rpnSelection = NullRPN;
+                break;
+
+            case 100: // RPN LSB
+                rpnSelection = (rpnSelection & ~0x7F) | value;
+                break;
+
+            case 101: // RPN MSB
+                rpnSelection = (value << 7) | (rpnSelection & 0x7F);
+                break;
+
+            case 121:
+                ResetControllers();
+                break;
+
+            case 96:  // data increment
+            case 97:  // data decrement
+            case 120: // all sound off
+            case 122: // local control
+            case 123: // all notes off
+            case 124: // omni off
+            case 125: // omni on
+            case 126: // mono on
+            case 127: // poly on
+                break;
+
+            default:
+                controls[id] = value;
+            }
+        }
+    };
+
+    using ChaseState = std::array<ChannelState, Channels>;
+
+    MIDITimeline() : duration(0.0), format(fmidi_fileformat_smf) {}
+
+    /// @brief Parses a MIDI file (SMF, XMI or MUS) from memory and compiles it.
+    /// @param buffer The MIDI file data.
+    /// @param bufferSize The size of the MIDI file data in bytes.
+    /// @return true if there is anything to play.
+    bool Load(const uint8_t *buffer, size_t bufferSize)
+    {
+        Clear();
+
+        fmidi_smf_u smf(fmidi_auto_mem_read(buffer, bufferSize));
+        if (!smf)
+        {
+            return false;
+        }
+
+        format = fmidi_mem_identify(buffer, bufferSize);
+
+        fmidi_seq_u seq(fmidi_seq_new(smf.get()));
+        if (!seq)
+        {
+            return false;
+        }
+
+        fmidi_seq_event_t sqevt;
+        while (fmidi_seq_next_event(seq.get(), &sqevt))
+        {
+            duration = sqevt.time; // the song ends with its last event of any kind
+
+            const auto &event = *sqevt.event;
+            if (event.type != fmidi_event_message || !event.datalen)
+            {
+                continue;
+            }
+
+            auto kind = EventKind::Message;
+            if (event.data[0] == 0xF0u)
+            {
+                if (IsSysExEqual(event.data, SysExResetXG))
+                {
+                    kind = EventKind::ResetXG;
+                }
+                else if (IsSysExReset(event.data))
+                {
+                    kind = EventKind::Reset;
+                }
+            }
+
+            events.push_back({sqevt.time, uint32_t(data.size()), event.datalen, kind});
+            data.insert(data.end(), event.data, event.data + event.datalen);
+        }
+
+        // Record the channel state every few events so that a seek only needs to replay a handful of them
+        ChaseState state;
+        ResetChaseState(state);
+
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            if (i % ChaseSnapshotInterval == 0)
+            {
+                snapshots.push_back({i, state});
+            }
+
+            UpdateChaseState(state, events[i].kind, GetEventData(events[i]), events[i].length);
+        }
+
+        return !events.empty();
+    }
+
+    void Clear()
+    {
+        events.clear();
+        data.clear();
+        snapshots.clear();
+        duration = 0.0;
+        format = fmidi_fileformat_smf;
+    }
+
+    bool IsEmpty() const { return events.empty(); }
+
+    size_t GetSize() const { return events.size(); }
+
+    const Event &GetEvent(size_t position) const { return events[position]; }
+
+    const uint8_t *GetEventData(const Event &event) const { return &data[event.offset]; }
+
+    /// @brief Returns the time of the last event (of any kind) in seconds.
+    double GetDuration() const { return duration; }
+
+    fmidi_fileformat_t GetFormat() const { return format; }
+
+    /// @brief Finds the first event at or after the given time using a binary search.
+    /// @param time The time in seconds.
+    /// @return The event position (GetSize() if there is no such event).
+    size_t FindPosition(double time) const
+    {
+        return std::lower_bound(events.begin(), events.end(), time, [](const Event &event, double time)
+                                { return event.time < time; }) -
+               events.begin();
+    }
+
+    /// @brief Rebuilds the channel state just before the event at position from the nearest earlier snapshot.
+    /// @param position The event position.
+    /// @return The state of all channels.
+    ChaseState GetChaseState(size_t position) const
+    {
+        ChaseState state;
+
+        if (snapshots.empty())
+        {
+            ResetChaseState(state);
+            return state;
+        }
+
+        // There is always a snapshot at position 0
+        auto snapshot = std::upper_bound(snapshots.begin(), snapshots.end(), position, [](size_t position, const ChaseSnapshot &snapshot)
+                                         { return position < snapshot.position; }) -
+                        1;
+
+        state = snapshot->channels;
+        for (auto i = snapshot->position; i < position && i < events.size(); i++)
+        {
+            UpdateChaseState(state, events[i].kind, GetEventData(events[i]), events[i].length);
+        }
+
+        return state;
+    }
+
+    /// @brief Sets all channels to their power-on state.
+    static void ResetChaseState(ChaseState &state)
+    {
+        for (auto &channel : state)
+        {
+            channel.Reset();
+        }
+    }
+
+    /// @brief Updates the channel state with a MIDI message.
+    /// @param state The state of all channels.
+    /// @param kind The kind of event.
+    /// @param message The message bytes.
+    /// @param length The number of message bytes.
+    static void UpdateChaseState(ChaseState &state, EventKind kind, const uint8_t *message, uint32_t length)
+    {
+        if (kind != EventKind::Message)
+        {
+            ResetChaseState(state);
+            return;
+        }
+
+        if (message[0] >= 0xF0u || length < 2)
+        {
+            return;
+        }
+
+        auto &channel = state[message[0] & 0xF];
+
+        switch (message[0] >> 4)
+        {
+        case 0b1011: // control change
+            if (length >= 3)
+            {
+                channel.Control(message[1] & 127, message[2] & 127);
+            }
+            break;
+
+        case 0b1100: // program change
+            channel.program = message[1] & 127;
+            break;
+
+        case 0b1101: // channel pressure
+            channel.pressure = message[1] & 127;
+            break;
+
+        case 0b1110: // pitch bend
+            if (length >= 3)
+            {
+                channel.pitchBend = ((message[2] & 127) << 7) | (message[1] & 127);
+            }
+            break;
+        }
+    }
+
+    /// @brief Check if the given SysEx message is a reset message.
+    /// @param data The SysEx message to check.
+    /// @returns true if the message is a reset message, false otherwise.
+    static bool IsSysExReset(const uint8_t *data)
+    {
+        return IsSysExEqual(data, SysExResetGM) || IsSysExEqual(data, SysExResetGM2) || IsSysExEqual(data, SysExResetGS) || IsSysExEqual(data, SysExResetXG);
+    }
+
+    /// @brief Compares two SysEx messages to determine if they are equal.
+    /// @param a Pointer to the first SysEx message.
+    /// @param b Pointer to the second SysEx message.
+    /// @return true if both SysEx messages are equal, false otherwise.
+    static bool IsSysExEqual(const uint8_t *a, const uint8_t *b)
+    {
+        while ((*a != SysExEnd) && (*b != SysExEnd) && (*a == *b))
+        {
+            a++;
+            b++;
+        }
+
+        return (*a == *b);
+    }
+
+private:
+    /// @brief The state of all channels just before the event at position.
+    struct ChaseSnapshot
+    {
+        size_t position;
+        ChaseState channels;
+    };
+
+    std::vector<Event> events;             // all tracks merged and sorted by time
+    std::vector<uint8_t> data;             // message bytes of all events
+    std::vector<ChaseSnapshot> snapshots;  // one every ChaseSnapshotInterval events
+    double duration;
+    fmidi_fileformat_t format;
+};
@@ -6,14 +6,58 @@
 #pragma once
 
 #include "Types.h"
+#include "ResourceHandleManager.h"
+#include "WorkerPool.h"
 #include "external/opal.h"
+#include <algorithm>
 #include <memory>
+#include <vector>
 
 class OPL3
 {
 private:
+    static constexpr uint32_t BLOCK_FRAMES = 64; // frames rendered between two idle checks
+
+    /// @brief A register write that is applied when rendering reaches frame (relative to the next GenerateSamples() call).
+    struct QueuedWrite
+    {
+        uint32_t frame;
+        uint16_t address;
+        uint8_t data;
+    };
+
     std::unique_ptr<Opal> chip;
     uint32_t sampleRate;
+    bool isIdle;                    // the chip is known to be silent until the next register write
+    std::vector<QueuedWrite> queue; // sorted by frame; writes with the same frame keep their order
+
+    void Render(float *buffer, uint32_t frames)
+    {
+        static constexpr float normalization_factor = 1.0f / 32768.0f;
+
+        int16_t block[BLOCK_FRAMES * 2];
+
+        while (frames)
+        {
+            if (isIdle)
+            {
+                std::fill(buffer, buffer + size_t(frames) * 2, 0.0f);
+                return;
+            }
+
+            auto count = std::min(frames, BLOCK_FRAMES);
+
+            for (uint32_t i = 0; i < count; i++)
+                chip->Sample(&block[i * 2], &block[i * 2 + 1]);
+
+            for (uint32_t i = 0; i < count * 2; i++)
+                buffer[i] = block[i] * normalization_factor;
+
+            buffer += count * 2;
+            frames -= count;
+            isIdle = chip->IsIdle();
+        }
+    }
 
 public:
     OPL3(uint32_t sampleRate)
@@ -31,30 +75,79 @@ public:
     {
         chip.reset();
         chip = std::make_unique<Opal>(sampleRate);
+        isIdle = chip->IsIdle();
+        queue.clear();
     }
 
     uint32_t GetSampleRate() const { return sampleRate; }
 
+    /// @brief Returns true if the chip is silent and no register writes are pending.
+    bool IsIdle() const { return isIdle and queue.empty(); }
+
+    static constexpr size_t GetStateSize() { return Opal::GetStateSize(); }
+
+    /// @brief Copies the complete chip state (operators, channels, envelopes, phases) into buffer (GetStateSize() bytes).
+    void SaveState(void *buffer) const
+    {
+        chip->SaveState(buffer);
+    }
+
+    /// @brief Restores a state saved by SaveState(). Queued register writes are dropped. The state should come from a chip
+    /// running at the same sample rate.
+    void RestoreState(const void *buffer)
+    {
+        chip->RestoreState(buffer);
+        isIdle = chip->IsIdle();
+        queue.clear();
+    }
+
     void WriteRegister(uint16_t address, uint8_t data)
     {
         chip->Port(address, data);
+        isIdle = false;
     }
 
-    void GenerateSamples(float *buffer, uint32_t frames)
+    /// @brief Queues a register write that is applied frameOffset frames into the next GenerateSamples() call. Writes
+    /// beyond the end of that call are carried over to the following calls.
+    void QueueWriteRegister(uint32_t frameOffset, uint16_t address, uint8_t data)
     {
-        static constexpr float normalization_factor = 1.0f / 32768.0f;
+        QueuedWrite write = {frameOffset, address, data};
+
+        if (queue.empty() or queue.back().frame <= frameOffset)
+            queue.push_back(write);
+        else
+            queue.insert(std::upper_bound(queue.begin(), queue.end(), write, [](const QueuedWrite &a, const QueuedWrite &b)
+                                          { return a.frame < b.frame; }),
+                         write);
+    }
 
-        std::pair<int16_t, int16_t> output;
-        uint32_t sample = 0;
+    /// @brief Renders stereo interleaved samples into buffer (overwriting it).
+    /// Queued register writes are applied at their exact frame. Between writes the chip is run in small blocks. After
+    /// each block the operator envelopes are checked and once they have all finished the rest of the span is filled
+    /// with silence without running the emulator.
+    void GenerateSamples(float *buffer, uint32_t frames)
+    {
+        size_t head = 0;
+        uint32_t position = 0;
 
-        while (sample < frames * 2)
+        while (position < frames)
         {
-            chip->Sample(&output.first, &output.second);
-            buffer[sample] = output.first * normalization_factor;
-            buffer[sample + 1] = output.second * normalization_factor;
+            while (head < queue.size() and queue[head].frame <= position)
+            {
+                WriteRegister(queue[head].address, queue[head].data);
+                head++;
+            }
+
+            auto end = head < queue.size() ? std::min(queue[head].frame, frames) : frames;
 
-            sample += 2;
+            Render(buffer + size_t(position) * 2, end - position);
+            position = end;
         }
+
+        // Drop what was applied and rebase the rest on the next call
+        queue.erase(queue.begin(), queue.begin() + head);
+        for (auto &write : queue)
+            write.frame -= frames;
     }
 
     OPL3() = delete;
@@ -64,54 +157,160 @@ public:
     OPL3 &operator=(OPL3 &&) = delete;
 };
 
-static std::unique_ptr<OPL3> g_OPL3Chip;
+static ResourceHandleManager<OPL3> g_OPL3ChipManager;
+static ResourceHandleManager<OPL3>::Handle g_OPL3DefaultChip = ResourceHandleManager<OPL3>::InvalidHandle; // used by the single-chip API
+static WorkerPool g_OPL3Workers; // renders OPL3_GenerateSamplesBatch() jobs
+
+/// @brief Creates an OPL3 chip instance.
+/// @param sampleRate The sample rate to render at.
+/// @return A handle to the chip, or InvalidHandle if sampleRate is 0.
+inline ResourceHandleManager<OPL3>::Handle OPL3_CreateChip(uint32_t sampleRate)
+{
+    if (!sampleRate)
+        return ResourceHandleManager<OPL3>::InvalidHandle;
+
+    return g_OPL3ChipManager.CreateHandle(std::make_unique<OPL3>(sampleRate));
+}
+
+/// @brief Deletes a chip created using OPL3_CreateChip().
+/// @param handle A chip handle.
+inline void OPL3_DeleteChip(ResourceHandleManager<OPL3>::Handle handle)
+{
+    g_OPL3ChipManager.ReleaseHandle(handle);
+}
+
+/// @brief Resets a chip to its power-on state and drops any queued register writes.
+/// @param handle A chip handle.
+inline void OPL3_ResetChip(ResourceHandleManager<OPL3>::Handle handle)
+{
+    auto chip = g_OPL3ChipManager.GetResource(handle);
+    if (chip)
+        chip->Reset();
+}
+
+/// @brief Writes a chip register immediately.
+/// @param handle A chip handle.
+/// @param address The register address (0x000 - 0x1FF).
+/// @param data The value to write.
+inline void OPL3_WriteChipRegister(ResourceHandleManager<OPL3>::Handle handle, uint16_t address, uint8_t data)
+{
+    auto chip = g_OPL3ChipManager.GetResource(handle);
+    if (chip)
+        chip->WriteRegister(address, data);
+}
+
+/// @brief Queues a chip register write frameOffset frames into the next render call.
+/// @param handle A chip handle.
+/// @param frameOffset The frame at which the write is applied.
+/// @param address The register address (0x000 - 0x1FF).
+/// @param data The value to write.
+inline void OPL3_QueueChipWriteRegister(ResourceHandleManager<OPL3>::Handle handle, uint32_t frameOffset, uint16_t address, uint8_t data)
+{
+    auto chip = g_OPL3ChipManager.GetResource(handle);
+    if (chip)
+        chip->QueueWriteRegister(frameOffset, address, data);
+}
+
+/// @brief Renders stereo interleaved FP32 samples from a chip.
+/// @param handle A chip handle.
+/// @param buffer The buffer to overwrite. This must have room for frames * 2 samples.
+/// @param frames The number of frames to render.
+inline void OPL3_GenerateChipSamples(ResourceHandleManager<OPL3>::Handle handle, float *buffer, uint32_t frames)
+{
+    auto chip = g_OPL3ChipManager.GetResource(handle);
+    if (chip)
+        chip->GenerateSamples(buffer, frames);
+}
+
+/// @brief Returns the size of a chip state buffer in bytes.
+inline uint32_t OPL3_GetChipStateSize()
+{
+    return uint32_t(OPL3::GetStateSize());
+}
+
+/// @brief Saves the complete state of a chip.
+/// @param handle A chip handle.
+/// @param buffer A buffer of at least OPL3_GetChipStateSize() bytes.
+inline void OPL3_SaveChipState(ResourceHandleManager<OPL3>::Handle handle, uintptr_t buffer)
+{
+    auto chip = g_OPL3ChipManager.GetResource(handle);
+    if (chip and buffer)
+        chip->SaveState(reinterpret_cast<void *>(buffer));
+}
+
+/// @brief Restores the state of a chip saved using OPL3_SaveChipState(). The state can come from any chip with the same
+/// sample rate.
+/// @param handle A chip handle.
+/// @param buffer A buffer filled by OPL3_SaveChipState().
+inline void OPL3_RestoreChipState(ResourceHandleManager<OPL3>::Handle handle, uintptr_t buffer)
+{
+    auto chip = g_OPL3ChipManager.GetResource(handle);
+    if (chip and buffer)
+        chip->RestoreState(reinterpret_cast<const void *>(buffer));
+}
+
+/// @brief Renders several chips at once, spreading them across persistent worker threads. Each chip renders into its own
+/// buffer.
+/// @param handleArray An array of chip handles. Invalid handles are skipped.
+/// @param bufferArray An array of pointers to stereo interleaved FP32 buffers (one per handle).
+/// @param count The number of entries in handleArray and bufferArray.
+/// @param frames The number of frames to render into every buffer.
+inline void OPL3_GenerateSamplesBatch(const ResourceHandleManager<OPL3>::Handle *handleArray, const uintptr_t *bufferArray, uint32_t count, uint32_t frames)
+{
+    // Resolve the handles up front so that the workers never touch the manager
+    std::vector<std::pair<OPL3 *, float *>> jobs;
+    jobs.reserve(count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        auto chip = g_OPL3ChipManager.GetResource(handleArray[i]);
+        if (chip and bufferArray[i])
+            jobs.emplace_back(chip, reinterpret_cast<float *>(bufferArray[i]));
+    }
+
+    // The workers are created on the first batch and stay parked between calls (see __OPL3_Finalize())
+    g_OPL3Workers.Run(jobs.size(), [&jobs, frames](size_t i)
+                      { jobs[i].first->GenerateSamples(jobs[i].second, frames); });
+}
 
 inline qb_bool __OPL3_Initialize(uint32_t sampleRate)
 {
-    if (g_OPL3Chip)
+    if (g_OPL3ChipManager.IsHandleValid(g_OPL3DefaultChip))
         return QB_TRUE;
 
-    if (!sampleRate)
-        return QB_FALSE;
+    g_OPL3DefaultChip = OPL3_CreateChip(sampleRate);
 
-    g_OPL3Chip = std::make_unique<OPL3>(sampleRate);
-
-    return TO_QB_BOOL(g_OPL3Chip != nullptr);
+    return TO_QB_BOOL(g_OPL3DefaultChip != ResourceHandleManager<OPL3>::InvalidHandle);
 }
 
 inline void __OPL3_Finalize()
 {
-    if (!g_OPL3Chip)
-        return;
-
-    g_OPL3Chip.reset();
+    OPL3_DeleteChip(g_OPL3DefaultChip);
+    g_OPL3DefaultChip = ResourceHandleManager<OPL3>::InvalidHandle;
+    g_OPL3Workers.Stop();
 }
 
 inline qb_bool OPL3_IsInitialized()
 {
-    return TO_QB_BOOL(g_OPL3Chip != nullptr);
+    return TO_QB_BOOL(g_OPL3ChipManager.IsHandleValid(g_OPL3DefaultChip));
 }
 
 inline void OPL3_Reset()
 {
-    if (!g_OPL3Chip)
-        return;
-
-    g_OPL3Chip->Reset();
+    OPL3_ResetChip(g_OPL3DefaultChip);
 }
 
 inline void OPL3_WriteRegister(uint16_t address, uint8_t data)
 {
-    if (!g_OPL3Chip)
-        return;
+    OPL3_WriteChipRegister(g_OPL3DefaultChip, address, data);
+}
 
-    g_OPL3Chip->WriteRegister(address, data);
+inline void OPL3_QueueWriteRegister(uint32_t frameOffset, uint16_t address, uint8_t data)
+{
+    OPL3_QueueChipWriteRegister(g_OPL3DefaultChip, frameOffset, address, data);
 }
 
 inline void __OPL3_GenerateSamples(float *buffer, uint32_t frames)
 {
-    if (!g_OPL3Chip)
-        return;
-
-    g_OPL3Chip->GenerateSamples(buffer, frames);
+    OPL3_GenerateChipSamples(g_OPL3DefaultChip, buffer, frames);
 }
@@ -0,0 +1,583 @@
+//----------------------------------------------------------------------------------------------------------------------
+// OPL register log (DRO / IMF / VGM) player for QB64-PE using Opal
+// Copyright (c) 2024 Samuel Gomes
+//
+// https://moddingwiki.shikadi.net/wiki/DRO_Format
+// https://moddingwiki.shikadi.net/wiki/IMF_Format
+// https://vgmrips.net/wiki/VGM_Specification
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Types.h"
+#include "ResourceHandleManager.h"
+#include "OPL3.h"
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+/// @brief Plays OPL register logs through an OPL3 chip.
+/// The log is parsed once into a flat array of timestamped register writes. Rendering queues every write that falls in
+/// the requested block on the chip (see OPL3::QueueWriteRegister()) and renders the whole block in one call.
+/// While the log plays uninterrupted from the start, chip snapshots are stored every SNAPSHOT_INTERVAL seconds so that a
+/// seek only has to restore the nearest earlier snapshot and replay the writes after it.
+class OPL3Log
+{
+public:
+    enum Format
+    {
+        FORMAT_UNKNOWN = 0,
+        FORMAT_DRO,
+        FORMAT_IMF,
+        FORMAT_VGM
+    };
+
+    static constexpr uint32_t IMF_RATE_DEFAULT = 560; // Commander Keen; Wolfenstein 3-D uses 700
+    static constexpr uint32_t DRO_RATE = 1000;         // delays are in milliseconds
+    static constexpr uint32_t VGM_RATE = 44100;        // delays are in 44.1 kHz samples
+    static constexpr double SNAPSHOT_INTERVAL = 2.0;   // seconds
+
+    /// @brief A register write. tick is the absolute time in the log's own time base.
+    struct Command
+    {
+        uint32_t tick;
+        uint16_t address;
+        uint8_t data;
+    };
+
+    /// @brief The chip state at an output frame. position is the first command that was not yet written.
+    struct Snapshot
+    {
+        uint64_t frame;
+        size_t position;
+        std::vector<uint8_t> state;
+    };
+
+    OPL3Log(uint32_t sampleRate) : chip(sampleRate), format(FORMAT_UNKNOWN), tickRate(1), totalTicks(0), loopIndex(0), loopTick(0), isLooping(false), isOPL3(false)
+    {
+        Restart();
+    }
+
+    OPL3Log() = delete;
+    OPL3Log(const OPL3Log &) = delete;
+    OPL3Log &operator=(const OPL3Log &) = delete;
+
+    /// @brief Parses a log from memory.
+    /// @param data The file contents.
+    /// @param size The size of data in bytes.
+    /// @param imfRate The tick rate for IMF files (which do not store it). 0 selects IMF_RATE_DEFAULT.
+    /// @return True if the data was recognized and contains at least one register write.
+    bool Load(const uint8_t *data, size_t size, uint32_t imfRate)
+    {
+        commands.clear();
+        snapshots.clear();
+        format = FORMAT_UNKNOWN;
+        totalTicks = loopTick = 0;
+        isOPL3 = false;
+        loopIndex = SIZE_MAX; // set by the parser if the log has a loop point
+
+        if (size >= 8 and !std::memcmp(data, "DBRAWOPL", 8))
+            format = ParseDRO(data, size) ? FORMAT_DRO : FORMAT_UNKNOWN;
+        else if (size >= 0x40 and !std::memcmp(data, "Vgm ", 4))
+            format = ParseVGM(data, size) ? FORMAT_VGM : FORMAT_UNKNOWN;
+        else
+            format = ParseIMF(data, size, imfRate ? imfRate : IMF_RATE_DEFAULT) ? FORMAT_IMF : FORMAT_UNKNOWN;
+
+        if (format == FORMAT_UNKNOWN or commands.empty())
+        {
+            commands.clear();
+            format = FORMAT_UNKNOWN;
+            return false;
+        }
+
+        // Logs without a loop point loop from the start
+        totalTicks = std::max(totalTicks, commands.back().tick);
+        if (loopIndex >= commands.size())
+        {
+            loopIndex = 0;
+            loopTick = 0;
+        }
+
+        Restart();
+
+        return true;
+    }
+
+    Format GetFormat() const { return format; }
+
+    void SetLooping(bool looping) { isLooping = looping; }
+
+    bool IsLooping() const { return isLooping; }
+
+    /// @brief Returns true while there are commands left to play (always true for a looping log).
+    bool IsPlaying() const { return format != FORMAT_UNKNOWN and (isLooping or position < commands.size() or frame < TickToFrame(PlayTick(totalTicks))); }
+
+    double GetLength() const { return double(totalTicks) / tickRate; }
+
+    double GetPosition() const { return double(frame) / chip.GetSampleRate(); }
+
+    /// @brief Renders stereo interleaved FP32 samples (overwriting buffer).
+    /// @return True while the log is playing.
+    bool Render(float *buffer, uint32_t frames)
+    {
+        const auto end = frame + frames;
+
+        while (format != FORMAT_UNKNOWN)
+        {
+            // Queue everything that lands in this block
+            while (position < commands.size())
+            {
+                auto commandFrame = TickToFrame(PlayTick(commands[position].tick));
+                if (commandFrame >= end)
+                    break;
+
+                auto &command = commands[position];
+                chip.QueueWriteRegister(uint32_t(std::max(commandFrame, frame) - frame), command.address, command.data);
+                position++;
+            }
+
+            // Wrap around if the log ends inside this block and we have a loop point
+            if (position < commands.size() or !isLooping or totalTicks <= loopTick or TickToFrame(PlayTick(totalTicks)) >= end)
+                break;
+
+            loops++;
+            position = loopIndex;
+        }
+
+        chip.GenerateSamples(buffer, frames);
+        frame = end;
+
+        // The write queue is empty at this point so the chip state is exactly the state at frame
+        if (isContinuous and !loops and frame >= nextSnapshotFrame and (snapshots.empty() or snapshots.back().frame < frame))
+        {
+            snapshots.push_back(Snapshot{frame, position, std::vector<uint8_t>(OPL3::GetStateSize())});
+            chip.SaveState(snapshots.back().state.data());
+            nextSnapshotFrame = frame + uint64_t(SNAPSHOT_INTERVAL * chip.GetSampleRate());
+        }
+
+        return IsPlaying();
+    }
+
+    /// @brief Moves the playback position. The chip is restored from the nearest earlier snapshot (or reset) and every
+    /// write between that point and the new position is replayed.
+    /// @param seconds The new position in seconds (clamped to the length of the log).
+    void Seek(double seconds)
+    {
+        if (format == FORMAT_UNKNOWN)
+            return;
+
+        auto targetTick = uint32_t(std::clamp(seconds, 0.0, GetLength()) * tickRate);
+        auto targetFrame = TickToFrame(targetTick);
+
+        auto snapshot = std::upper_bound(snapshots.begin(), snapshots.end(), targetFrame, [](uint64_t f, const Snapshot &s)
+                                         { return f < s.frame; });
+
+        if (snapshot != snapshots.begin())
+        {
+            --snapshot;
+            chip.RestoreState(snapshot->state.data());
+            position = snapshot->position;
+            frame = snapshot->frame;
+            loops = 0;
+        }
+        else
+        {
+            Restart();
+        }
+
+        // Writes replayed without rendering in between are not exact, so stop taking snapshots until the next restart
+        isContinuous = frame == targetFrame;
+
+        while (position < commands.size() and TickToFrame(commands[position].tick) < targetFrame)
+        {
+            chip.WriteRegister(commands[position].address, commands[position].data);
+            position++;
+        }
+
+        frame = targetFrame;
+    }
+
+    /// @brief Resets the chip and rewinds to the start.
+    void Restart()
+    {
+        chip.Reset();
+        position = 0;
+        frame = 0;
+        loops = 0;
+        nextSnapshotFrame = 0;
+        isContinuous = true;
+    }
+
+private:
+    /// @brief Maps a log tick to the current pass through the log.
+    uint64_t PlayTick(uint32_t tick) const { return tick + loops * uint64_t(totalTicks - loopTick); }
+
+    uint64_t TickToFrame(uint64_t tick) const { return tick * chip.GetSampleRate() / tickRate; }
+
+    static uint16_t ReadU16(const uint8_t *p) { return uint16_t(p[0] | (p[1] << 8)); }
+
+    static uint32_t ReadU32(const uint8_t *p) { return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24); }
+
+    /// @brief Appends a register write. Opal has no OPL2 mode and silences channels whose C0-C8 output bits are clear,
+    /// so those bits are set on every write until the log enables OPL3 mode (as OPL2 hardware outputs all channels).
+    void AddCommand(uint32_t tick, uint16_t address, uint8_t data)
+    {
+        address &= 0x1FF;
+
+        if (address == 0x105)
+            isOPL3 = data & 1;
+        else if (!isOPL3 and (address & 0xFF) >= 0xC0 and (address & 0xFF) <= 0xC8)
+            data |= 0x30;
+
+        commands.push_back(Command{tick, address, data});
+    }
+
+    bool ParseDRO(const uint8_t *data, size_t size)
+    {
+        if (size < 12)
+            return false;
+
+        tickRate = DRO_RATE;
+        auto major = ReadU16(data + 8);
+        uint32_t tick = 0;
+
+        if (major == 2)
+        {
+            if (size < 26)
+                return false;
+
+            auto pairs = ReadU32(data + 12);
+            auto shortDelay = data[23], longDelay = data[24];
+            auto codemapLength = data[25];
+            auto codemap = data + 26;
+            auto p = codemap + codemapLength;
+            auto end = data + size;
+
+            if (p > end)
+                return false;
+
+            for (uint32_t i = 0; i < pairs and p + 2 <= end; i++, p += 2)
+            {
+                auto code = p[0], value = p[1];
+
+                if (code == shortDelay)
+                    tick += value + 1;
+                else if (code == longDelay)
+                    tick += (value + 1) << 8;
+                else if ((code & 0x7F) < codemapLength)
+                    AddCommand(tick, codemap[code & 0x7F] | ((code & 0x80) << 1), value);
+            }
+        }
+        else
+        {
+            if (size < 24)
+                return false;
+
+            // Early v0.1 files store the hardware type in one byte instead of four
+            auto p = data + (data[21] or data[22] or data[23] ? 21 : 24);
+            auto end = data + size;
+            uint16_t bank = 0;
+
+            while (p < end)
+            {
+                auto code = *p++;
+
+                switch (code)
+                {
+                case 0x00:
+                    if (p < end)
+                        tick += *p++ + 1;
+                    break;
+
+                case 0x01:
+                    if (p + 2 <= end)
+                    {
+                        tick += ReadU16(p) + 1;
+                        p += 2;
+                    }
+                    else
+                        p = end;
+                    break;
+
+                case 0x02:
+                case 0x03:
+                    bank = (code - 0x02) << 8;
+                    break;
+
+                case 0x04:
+                    if (p + 2 <= end)
+                    {
+                        AddCommand(tick, bank | p[0], p[1]);
+                        p += 2;
+                    }
+                    else
+                        p = end;
+                    break;
+
+                default:
+                    if (p < end)
+                        AddCommand(tick, bank | code, *p++);
+                }
+            }
+        }
+
+        totalTicks = tick;
+
+        return true;
+    }
+
+    bool ParseIMF(const uint8_t *data, size_t size, uint32_t rate)
+    {
+        if (size < 4)
+            return false;
+
+        tickRate = rate;
+
+        // Type 1 files start with the length of the command data
+        size_t start = 0, length = size & ~size_t(3);
+        auto header = ReadU16(data);
+        if (header and !(header & 3) and header <= size - 2)
+        {
+            start = 2;
+            length = header;
+        }
+
+        uint32_t tick = 0;
+        for (auto p = data + start; p + 4 <= data + start + length; p += 4)
+        {
+            AddCommand(tick, p[0], p[1]);
+            tick += ReadU16(p + 2);
+        }
+
+        totalTicks = tick;
+
+        return true;
+    }
+
+    bool ParseVGM(const uint8_t *data, size_t size)
+    {
+        tickRate = VGM_RATE;
+
+        auto version = ReadU32(data + 0x08);
+        size_t dataOffset = version >= 0x150 and ReadU32(data + 0x34) ? 0x34 + ReadU32(data + 0x34) : 0x40;
+        size_t loopOffset = ReadU32(data + 0x1C) ? 0x1C + ReadU32(data + 0x1C) : 0;
+        auto eofOffset = std::min(size_t(ReadU32(data + 0x04)) + 4, size);
+
+        if (dataOffset >= size)
+            return false;
+
+        uint32_t tick = 0;
+        auto p = dataOffset;
+        auto end = eofOffset > dataOffset ? eofOffset : size;
+
+        while (p < end)
+        {
+            if (loopOffset and p == loopOffset)
+            {
+                loopIndex = commands.size();
+                loopTick = tick;
+            }
+
+            auto code = data[p];
+
+            // Number of operand bytes for commands we do not handle
+            size_t operands;
+            if (code >= 0x30 and code <= 0x3F)
+                operands = 1;
+            else if ((code >= 0x40 and code <= 0x4E) or (code >= 0x51 and code <= 0x5F) or (code >= 0xA0 and code <= 0xBF))
+                operands = 2;
+            else if (code == 0x4F or code == 0x50)
+                operands = 1;
+            else if (code >= 0xC0 and code <= 0xDF)
+                operands = 3;
+            else if (code >= 0xE0)
+                operands = 4;
+            else
+                operands = 0;
+
+            switch (code)
+            {
+            case 0x5A: // YM3812
+            case 0x5B: // YM3526
+            case 0x5C: // Y8950
+            case 0x5E: // YMF262 port 0
+            case 0x5F: // YMF262 port 1
+            case 0xAA: // second YM3812
+                if (p + 3 > end)
+                    return !commands.empty();
+                AddCommand(tick, data[p + 1] | (code == 0x5F or code == 0xAA ? 0x100 : 0), data[p + 2]);
+                p += 3;
+                break;
+
+            case 0x61:
+                if (p + 3 > end)
+                    return !commands.empty();
+                tick += ReadU16(data + p + 1);
+                p += 3;
+                break;
+
+            case 0x62:
+                tick += 735;
+                p++;
+                break;
+
+            case 0x63:
+                tick += 882;
+                p++;
+                break;
+
+            case 0x66:
+                p = end;
+                break;
+
+            case 0x67: // data block
+                if (p + 7 > end)
+                    return !commands.empty();
+                p += 7 + (ReadU32(data + p + 3) & 0x7FFFFFFF);
+                break;
+
+            case 0x90:
+            case 0x91:
+            case 0x95:
+                p += 5;
+                break;
+
+            case 0x92:
+                p += 6;
+                break;
+
+            case 0x93:
+                p += 11;
+                break;
+
+            case 0x94:
+                p += 2;
+                break;
+
+            case 0x68: // PCM RAM write
+                p += 12;
+                break;
+
+            default:
+                if (code >= 0x70 and code <= 0x7F)
+                    tick += (code & 0x0F) + 1;
+                else if (code >= 0x80 and code <= 0x8F)
+                    tick += code & 0x0F;
+
+                p += 1 + operands;
+            }
+        }
+
+        totalTicks = tick;
+
+        return true;
+    }
+
+    OPL3 chip;
+    std::vector<Command> commands;
+    Format format;
+    uint32_t tickRate;
+    uint32_t totalTicks;
+    size_t loopIndex;
+    uint32_t loopTick;
+    bool isLooping;
+    bool isOPL3; // parser state: the log has set the OPL3 enable bit
+    size_t position; // next command to queue
+    uint64_t frame;  // output frames rendered since the last restart
+    uint64_t loops;
+    std::vector<Snapshot> snapshots; // sorted by frame; first pass only
+    uint64_t nextSnapshotFrame;
+    bool isContinuous; // playback has not been interrupted by a seek since the last restart
+};
+
+static ResourceHandleManager<OPL3Log> g_OPL3LogManager;
+
+/// @brief Loads an OPL register log (DRO, IMF or uncompressed VGM) from memory.
+/// @param sampleRate The sample rate to render at.
+/// @param buffer The file contents.
+/// @param size The size of buffer in bytes.
+/// @param imfRate The tick rate for IMF files (0 = 560 Hz).
+/// @return A handle to the log player, or InvalidHandle if the data was not recognized.
+inline ResourceHandleManager<OPL3Log>::Handle OPL3Log_Load(uint32_t sampleRate, const char *buffer, uint32_t size, uint32_t imfRate)
+{
+    if (!sampleRate or !buffer or !size)
+        return ResourceHandleManager<OPL3Log>::InvalidHandle;
+
+    auto log = std::make_unique<OPL3Log>(sampleRate);
+    if (!log->Load(reinterpret_cast<const uint8_t *>(buffer), size, imfRate))
+        return ResourceHandleManager<OPL3Log>::InvalidHandle;
+
+    return g_OPL3LogManager.CreateHandle(std::move(log));
+}
+
+/// @brief Deletes a log player created using OPL3Log_Load().
+/// @param handle A log player handle.
+inline void OPL3Log_Delete(ResourceHandleManager<OPL3Log>::Handle handle)
+{
+    g_OPL3LogManager.ReleaseHandle(handle);
+}
+
+/// @brief Returns the format of the loaded log (1 = DRO, 2 = IMF, 3 = VGM).
+/// @param handle A log player handle.
+inline int32_t OPL3Log_GetFormat(ResourceHandleManager<OPL3Log>::Handle handle)
+{
+    auto log = g_OPL3LogManager.GetResource(handle);
+    return log ? log->GetFormat() : OPL3Log::FORMAT_UNKNOWN;
+}
+
+/// @brief Renders the next block of the log.
+/// @param handle A log player handle.
+/// @param buffer A stereo interleaved FP32 buffer that is overwritten.
+/// @param frames The number of frames to render.
+/// @return True while the log is playing.
+inline qb_bool OPL3Log_Render(ResourceHandleManager<OPL3Log>::Handle handle, float *buffer, uint32_t frames)
+{
+    auto log = g_OPL3LogManager.GetResource(handle);
+    return log ? TO_QB_BOOL(log->Render(buffer, frames)) : QB_FALSE;
+}
+
+/// @brief Checks if the log is still playing.
+/// @param handle A log player handle.
+inline qb_bool OPL3Log_IsPlaying(ResourceHandleManager<OPL3Log>::Handle handle)
+{
+    auto log = g_OPL3LogManager.GetResource(handle);
+    return log ? TO_QB_BOOL(log->IsPlaying()) : QB_FALSE;
+}
+
+/// @brief Enables or disables looping. VGM files loop from their loop point, everything else from the start.
+/// @param handle A log player handle.
+/// @param looping True to loop.
+inline void OPL3Log_SetLooping(ResourceHandleManager<OPL3Log>::Handle handle, qb_bool looping)
+{
+    auto log = g_OPL3LogManager.GetResource(handle);
+    if (log)
+        log->SetLooping(bool(looping));
+}
+
+/// @brief Returns the length of the log in seconds (one pass).
+/// @param handle A log player handle.
+inline double OPL3Log_GetLength(ResourceHandleManager<OPL3Log>::Handle handle)
+{
+    auto log = g_OPL3LogManager.GetResource(handle);
+    return log ? log->GetLength() : 0.0;
+}
+
+/// @brief Returns the playback position in seconds.
+/// @param handle A log player handle.
+inline double OPL3Log_GetPosition(ResourceHandleManager<OPL3Log>::Handle handle)
+{
+    auto log = g_OPL3LogManager.GetResource(handle);
+    return log ? log->GetPosition() : 0.0;
+}
+
+/// @brief Seeks to a position in the log.
+/// @param handle A log player handle.
+/// @param seconds The new position in seconds.
+inline void OPL3Log_Seek(ResourceHandleManager<OPL3Log>::Handle handle, double seconds)
+{
+    auto log = g_OPL3LogManager.GetResource(handle);
+    if (log)
+        log->Seek(seconds);
+}
@@ -0,0 +1,80 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Handle-based resource management for libraries that expose objects to QB64
+// Copyright (c) 2024 Samuel Gomes
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <stack>
+#include <unordered_map>
+
+/// @brief A class to manage resource handles and associated resources.
+/// @tparam Resource The type of the resource to manage.
+template <typename Resource>
+class ResourceHandleManager
+{
+public:
+    using Handle = int32_t;
+
+    static const Handle InvalidHandle = 0;
+
+    /// @brief Constructor - initializes handles, reserving 0 for invalid.
+    ResourceHandleManager() : nextAvailableHandle(InvalidHandle + 1) {}
+
+    /// @brief Creates a new handle and associates it with a resource.
+    /// @param resource A unique pointer to the resource to store. Ownership is transferred.
+    /// @return A unique handle identifying the stored resource.
+    Handle CreateHandle(std::unique_ptr<Resource> resource)
+    {
+        Handle handle;
+        if (!availableHandles.empty())
+        {
+            handle = availableHandles.top();
+            availableHandles.pop();
+        }
+        else
+        {
+            handle = nextAvailableHandle++;
+        }
+
+        handleToResourceMap[handle] = std::move(resource);
+
+        return handle;
+    }
+
+    /// @brief Releases the resource associated with a handle.
+    /// @param handle The handle of the resource to release.
+    void ReleaseHandle(Handle handle)
+    {
+        auto it = handleToResourceMap.find(handle);
+        if (it != handleToResourceMap.end())
+        {
+            handleToResourceMap.erase(it);
+            availableHandles.push(handle);
+        }
+    }
+
+    /// @brief Retrieves a resource associated with a handle.
+    /// @param handle The handle of the resource to retrieve.
+    /// @return A pointer to the resource, or nullptr if the handle is invalid.
+    Resource *GetResource(Handle handle) const
+    {
+        auto it = handleToResourceMap.find(handle);
+        return (it != handleToResourceMap.end()) ? it->second.get() : nullptr;
+    }
+
+    /// @brief Checks if a handle is valid.
+    /// @param handle The handle to check.
+    /// @return True if the handle is valid, false otherwise.
+    bool IsHandleValid(Handle handle) const
+    {
+        return handleToResourceMap.find(handle) != handleToResourceMap.end();
+    }
+
+private:
+    std::unordered_map<Handle, std::unique_ptr<Resource>> handleToResourceMap;
+    std::stack<Handle> availableHandles;
+    Handle nextAvailableHandle;
+};
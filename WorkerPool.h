@@ -0,0 +1,168 @@
+//----------------------------------------------------------------------------------------------------------------------
+// Persistent worker threads for libraries that split a call into independent jobs
+// Copyright (c) 2024 Samuel Gomes
+//----------------------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/// @brief A fixed set of threads that are created once and parked on a condition variable between calls. Run() hands the
+/// jobs of one call to the workers and to the calling thread, so a call uses up to hardware_concurrency() cores without
+/// paying for thread creation.
+class WorkerPool
+{
+public:
+    WorkerPool() : invoke(nullptr), context(nullptr), jobCount(0), nextJob(0), generation(0), active(0), isStopping(false) {}
+
+    ~WorkerPool()
+    {
+        Stop();
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    /// @brief Calls work(i) for every i in [0, count) and returns when all calls have finished. The workers are started on
+    /// the first call. If another thread is already using the pool, the jobs run on the calling thread instead.
+    /// @param count The number of jobs.
+    /// @param work A callable taking the job index (size_t). Jobs must not depend on each other.
+    template <typename Function>
+    void Run(size_t count, Function &&work)
+    {
+        std::unique_lock<std::mutex> runLock(runMutex, std::try_to_lock);
+
+        if (count < 2 or !runLock or !Start())
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                work(i);
+            }
+
+            return;
+        }
+
+        {
+            // A worker that woke up too late for the previous call may still be looking at its (finished) job set
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]()
+                      { return active == 0; });
+
+            invoke = [](void *context, size_t i)
+            { (*static_cast<std::remove_reference_t<Function> *>(context))(i); };
+            this->context = const_cast<void *>(static_cast<const void *>(&work));
+            jobCount = count;
+            nextJob = 0;
+            generation++;
+        }
+
+        wake.notify_all();
+
+        Drain(); // the calling thread is a worker too
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]()
+                  { return active == 0; });
+    }
+
+    /// @brief Joins the worker threads. The next Run() starts them again.
+    void Stop()
+    {
+        std::lock_guard<std::mutex> runLock(runMutex);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isStopping = true;
+        }
+
+        wake.notify_all();
+
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        threads.clear();
+        isStopping = false;
+    }
+
+private:
+    /// @brief Creates the worker threads if there are none. Must be called with runMutex held.
+    /// @return True if there is at least one worker thread (false on single-core systems).
+    bool Start()
+    {
+        if (threads.empty())
+        {
+            auto cores = std::thread::hardware_concurrency();
+            auto count = cores > 1 ? cores - 1 : 0; // the calling thread makes up the rest
+
+            for (auto i = 0u; i < count; i++)
+            {
+                threads.emplace_back([this]()
+                                     { WorkerLoop(); });
+            }
+        }
+
+        return !threads.empty();
+    }
+
+    void WorkerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto seen = generation;
+
+        for (;;)
+        {
+            wake.wait(lock, [this, &seen]()
+                      { return isStopping or generation != seen; });
+
+            if (isStopping)
+            {
+                return;
+            }
+
+            seen = generation;
+            active++;
+
+            lock.unlock();
+            Drain();
+            lock.lock();
+
+            if (--active == 0)
+            {
+                done.notify_one();
+            }
+        }
+    }
+
+    /// @brief Claims and runs jobs until none are left. The job set cannot change while active is non-zero or the caller
+    /// is draining.
+    void Drain()
+    {
+        for (auto i = nextJob++; i < jobCount; i = nextJob++)
+        {
+            invoke(context, i);
+        }
+    }
+
+    std::mutex runMutex; // serializes Run() and Stop()
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<std::thread> threads;
+    void (*invoke)(void *, size_t);
+    void *context;
+    size_t jobCount;
+    std::atomic<size_t> nextJob;
+    uint64_t generation; // bumped for every Run()
+    uint32_t active;     // workers that are draining the current job set
+    bool isStopping;
+};
@@ -17,6 +17,8 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 //==================================================================================================
 // Opal class.
@@ -40,6 +42,7 @@ class Opal {
 
     // A single FM operator
     class Operator {
+        friend class Opal;
 
       public:
         Operator();
@@ -71,6 +74,10 @@ class Opal {
         void ComputeRates();
         void ComputeKeyScaleLevel();
 
+        bool IsEnvelopeOff() const {
+            return EnvelopeStage == EnvOff;
+        }
+
       protected:
         Opal *Master;            // Master object
         Channel *Chan;           // Owning channel
@@ -108,6 +115,7 @@ class Opal {
 
     // A single channel, which can contain two or more operators
     class Channel {
+        friend class Opal;
 
       public:
         Channel();
@@ -199,6 +207,52 @@ class Opal {
     void Port(uint16_t reg_num, uint8_t val);
     void Sample(int16_t *left, int16_t *right);
 
+    // True when every operator envelope is off and the resampler has settled, i.e. Sample() can only produce silence
+    // until a key-on is written through Port()
+    bool IsIdle() const {
+        for (auto &op : Op)
+            if (!op.IsEnvelopeOff())
+                return false;
+        return !LastOutput[0] && !LastOutput[1] && !CurrOutput[0] && !CurrOutput[1];
+    }
+
+    // State snapshots. Opal owns no heap memory so the object itself is the complete chip state. A snapshot is the
+    // address of the source object followed by a copy of it; on restore, pointers into the source are rebased onto this
+    // object (the envelope rate table pointers refer to static data and stay valid)
+    static constexpr size_t GetStateSize() {
+        return sizeof(uintptr_t) + sizeof(Opal);
+    }
+
+    void SaveState(void *buffer) const {
+        auto source = reinterpret_cast<uintptr_t>(this);
+        std::memcpy(buffer, &source, sizeof(source));
+        std::memcpy(static_cast<uint8_t *>(buffer) + sizeof(source), static_cast<const void *>(this), sizeof(Opal));
+    }
+
+    void RestoreState(const void *buffer) {
+        uintptr_t source;
+        std::memcpy(&source, buffer, sizeof(source));
+        std::memcpy(static_cast<void *>(this), static_cast<const uint8_t *>(buffer) + sizeof(source), sizeof(Opal));
+
+        auto rebase = [source, this](auto *&ptr) {
+            auto p = reinterpret_cast<uintptr_t>(ptr);
+            if (p >= source && p < source + sizeof(Opal))
+                ptr = reinterpret_cast<std::remove_reference_t<decltype(ptr)>>(reinterpret_cast<uintptr_t>(this) + (p - source));
+        };
+
+        for (auto &op : Op) {
+            rebase(op.Master);
+            rebase(op.Chan);
+        }
+
+        for (auto &chan : Chan) {
+            for (auto &op : chan.Op)
+                rebase(op);
+            rebase(chan.Master);
+            rebase(chan.ChannelPair);
+        }
+    }
+
   protected:
     void Init(int sample_rate);
     void Output(int16_t &left, int16_t &right);